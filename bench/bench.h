@@ -0,0 +1,23 @@
+#ifndef CLIDE_BENCH_H
+#define CLIDE_BENCH_H
+
+#include "clide.h"
+
+/**
+ * Writes a document of lines of random English words, about size bytes
+ * long, to a new temporary file and returns its path. The words and line
+ * lengths are always the same for the same size.
+ */
+extern char* write_synthetic_document(size_t size);
+
+/**
+ * Removes the file written by write_synthetic_document.
+ */
+extern void remove_synthetic_document(char *path);
+
+/**
+ * Returns the seconds passed since start on the monotonic clock.
+ */
+extern double seconds_since(const struct timespec *start);
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * Measures the load throughput of documents: mapped documents are split
+ * into lines, streamed ones are indexed to their end.
+ * Usage: load [size in MiB, default 256]
+ */
+#include "bench.h"
+
+static const int num_runs = 3;
+
+static void measure_load(const char *path, size_t size, bool is_streamed) {
+	config.stream_file_contents = is_streamed;
+	for (int run = 0; run < num_runs; run++) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		struct TextDocument *doc = open_document(path);
+		if (doc->stream != NULL) {
+			finish_document_stream(doc);
+		}
+		double seconds = seconds_since(&start);
+		printf(
+			"%-8s %zu lines: %6.0f ms  %6.0f MB/s\n",
+			is_streamed ? "streamed" : "mapped", doc->num_lines,
+			seconds * 1000, size / seconds / 1e6
+		);
+		close_document(doc);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+	char *path = write_synthetic_document(size);
+	measure_load(path, size, false);
+	measure_load(path, size, true);
+	remove_synthetic_document(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/**
+ * Measures the search throughput: the first match of a pattern is scanned
+ * for on the main thread, the match index is filled in by the search pool.
+ * A pattern without matches makes both scan the whole document.
+ * Usage: search [size in MiB, default 256]
+ */
+#include "bench.h"
+
+static void measure_search(const char *pattern, bool is_regex, size_t size) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	begin_search(0, 0);
+	update_search(pattern, strlen(pattern), is_regex);
+	double first_seconds = seconds_since(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t n;
+	list_matches(&n);
+	double index_seconds = seconds_since(&start);
+	printf(
+		"%-6s %-16s %9zu matches: first %6.0f ms, index %6.0f ms  %5.2f GB/s\n",
+		is_regex ? "regex" : "text", pattern, n,
+		first_seconds * 1000, index_seconds * 1000, size / index_seconds / 1e9
+	);
+	end_search();
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+	char *path = write_synthetic_document(size);
+	editor.document = open_document(path);
+	measure_search("zqxj", false, size);
+	measure_search("terminal window", false, size);
+	measure_search("the", false, size);
+	measure_search("[0-9]+", true, size);
+	measure_search("bu(ff|zz)er", true, size);
+	close_document(editor.document);
+	remove_synthetic_document(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "bench.h"
+
+static const char *const words[] = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was",
+	"with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from",
+	"at", "which", "but", "have", "an", "had", "they", "you", "were", "their",
+	"one", "all", "we", "can", "her", "has", "there", "been", "if", "more",
+	"when", "will", "would", "who", "so", "no", "document", "editor", "line",
+	"page", "search", "terminal", "character", "history", "buffer", "window",
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(*words))
+
+/* Lines are at most this long, 40 characters on average */
+static const size_t max_line_length = 80;
+
+char* write_synthetic_document(size_t size) {
+	static const char template[] = "/tmp/clide-bench-XXXXXX";
+	char *path = strdup(template);
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	const size_t block_size = 1 << 20;
+	char *block = malloc(block_size + max_line_length + 1);
+	size_t length = 0, written = 0;
+	srand(1);
+	while (written + length < size) {
+		size_t line_length = rand() % (max_line_length + 1);
+		size_t end = length + line_length;
+		while (length < end) {
+			const char *word = words[rand() % NUM_WORDS];
+			size_t n = min(strlen(word), end - length);
+			memcpy(block + length, word, n);
+			length += n;
+			if (length < end) {
+				block[length++] = ' ';
+			}
+		}
+		block[length++] = '\n';
+		if (length >= block_size) {
+			if (not write_fully(fd, block, length)) {
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+			written += length;
+			length = 0;
+		}
+	}
+	if (not write_fully(fd, block, length)) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	free(block);
+	close(fd);
+	return path;
+}
+
+void remove_synthetic_document(char *path) {
+	unlink(path);
+	free(path);
+}
+
+double seconds_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,52 @@
+/**
+ * Measures random line inserts and removes in documents of 1M and 10M
+ * lines, which find their page by descending the page tree.
+ * Usage: tree [number of edits, default 100000]
+ */
+#include "bench.h"
+
+static struct TextDocument* create_document(const char *path, size_t num_lines) {
+	struct TextDocument *doc = open_document(path);  /* Holds one line */
+	struct Line **lines = malloc(sizeof(*lines) * num_lines);
+	for (size_t i = 0; i + 1 < num_lines; i++) {
+		lines[i] = create_line();
+	}
+	insert_lines(&doc, 0, lines, num_lines - 1);
+	free(lines);
+	return doc;
+}
+
+static void measure_edits(const char *path, size_t num_lines, size_t num_edits) {
+	struct TextDocument *doc = create_document(path, num_lines);
+	struct timespec start;
+	srand(4);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_edits; i++) {
+		insert_line(&doc, rand() % (doc->num_lines + 1), create_line());
+	}
+	double insert_seconds = seconds_since(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < num_edits; i++) {
+		size_t index = rand() % doc->num_lines;
+		struct Line *line = *get_line(doc, index);
+		remove_line(&doc, index);
+		free_line(line);
+	}
+	double remove_seconds = seconds_since(&start);
+	printf(
+		"%9zu lines: %zu random inserts %4.0f ms (%.2f us each), removes %4.0f ms (%.2f us each)\n",
+		num_lines, num_edits,
+		insert_seconds * 1000, insert_seconds / num_edits * 1e6,
+		remove_seconds * 1000, remove_seconds / num_edits * 1e6
+	);
+	close_document(doc);
+}
+
+int main(int argc, char *argv[]) {
+	size_t num_edits = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	char *path = write_synthetic_document(0);  /* Empty */
+	measure_edits(path, 1000000, num_edits);
+	measure_edits(path, 10000000, num_edits);
+	remove_synthetic_document(path);
+	return EXIT_SUCCESS;
+}
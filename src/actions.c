@@ -5,7 +5,7 @@ bool can_move_left(void) {
 }
 
 bool can_move_right(void) {
-	return normalize(editor.column) < current_line()->length;
+	return normalize(editor.column) < length_of(current_line());
 }
 
 bool can_move_up(void) {
@@ -32,38 +32,45 @@ bool can_scroll(int n) {
 
 void move_left(void) {
 	assert (can_move_left());
-	editor.column--;
+	editor.column = 1+previous_character(current_line(), normalize(editor.column));
 	update_current_cursor();
 }
 
 void move_right(void) {
 	assert (can_move_right());
-	editor.column++;
+	editor.column = 1+next_character(current_line(), normalize(editor.column));
+	update_current_cursor();
+}
+
+/**
+ * Moves the cursor to another line, to the character drawn in the same
+ * screen column.
+ */
+static void move_vertically(size_t line) {
+	size_t x = screen_column_of(normalize(editor.line), normalize(editor.column));
+	editor.line = line;
+	editor.column = 1+position_at_screen_column(normalize(editor.line), x);
 	update_current_cursor();
 }
 
 void move_up(void) {
 	assert (can_move_up());
-	editor.line--;
-	update_current_cursor();
+	move_vertically(editor.line - 1);
 }
 
 void move_down(void) {
 	assert (can_move_down());
-	editor.line++;
-	update_current_cursor();
+	move_vertically(editor.line + 1);
 }
 
 void move_to_end_of_line(void) {
-	while (can_move_right()) {
-		move_right();
-	}
+	editor.column = 1+length_of(current_line());
+	update_current_cursor();
 }
 
 void move_to_beginning_of_line(void) {
-	while (can_move_left()) {
-		move_left();
-	}
+	editor.column = 1;
+	update_current_cursor();
 }
 
 void seek_left(void) {
@@ -86,7 +93,7 @@ void seek_right(void) {
 
 void scroll_page(int n) {
 	editor.line_offset += n;
-	print_page();
+	mark_page_damaged();
 }
 
 void move_to_next_page(void) {
@@ -0,0 +1,157 @@
+#include "clide.h"
+
+/**
+ * Block sizes, roughly growing by factors of 1.5. The largest class fits
+ * a full chunk of a long line including its header.
+ */
+static const size_t class_sizes[NUM_SIZE_CLASSES] = {
+	16, 24, 32, 48, 64, 96, 128, 192, 256, 384,
+	512, 768, 1024, 1536, 2048, 3072, 4104
+};
+
+/**
+ * An arena of ARENA_SIZE bytes, aligned to its size, so that the arena
+ * of a block is found by masking the address of the block. All blocks
+ * of an arena belong to the same size class.
+ */
+struct Arena {
+	struct Arena *prev, *next;  /* arenas of the class with free blocks */
+	void *free_blocks;  /* blocks that were freed, linked through their first bytes */
+	char *unused;  /* blocks that were never handed out begin here */
+	size_t num_blocks;  /* blocks handed out */
+	size_t size_class;
+	uint32_t *counters;  /* one per block, NULL until one is needed */
+};
+
+struct SizeClass {
+	struct Arena *available;
+	size_t num_arenas;
+};
+
+static struct SizeClass classes[NUM_SIZE_CLASSES];
+static struct AllocatorStats stats;
+
+/* Size classes by size in units of eight bytes, filled on first use */
+static uint8_t class_table[4104 / 8 + 1];
+
+static size_t class_of(size_t size) {
+	assert (size <= class_sizes[NUM_SIZE_CLASSES - 1]);
+	if (class_table[lengthof(class_table) - 1] == 0) {
+		for (size_t i = 0, j = 0; i < lengthof(class_table); i++) {
+			while (class_sizes[j] < 8 * i) j++;
+			class_table[i] = j;
+		}
+	}
+	return class_table[(size + 7) / 8];
+}
+
+static struct Arena* arena_of(void *block) {
+	return (struct Arena*)((uintptr_t)block & ~(uintptr_t)(ARENA_SIZE - 1));
+}
+
+/* The blocks of an arena begin after its header, aligned to 16 bytes */
+static const size_t arena_header_size = (sizeof(struct Arena) + 15) / 16 * 16;
+
+static size_t arena_capacity(size_t size_class) {
+	return (ARENA_SIZE - arena_header_size) / class_sizes[size_class];
+}
+
+static void link_arena(struct SizeClass *class, struct Arena *arena) {
+	arena->prev = NULL;
+	arena->next = class->available;
+	if (class->available != NULL) class->available->prev = arena;
+	class->available = arena;
+}
+
+static void unlink_arena(struct SizeClass *class, struct Arena *arena) {
+	if (arena->prev != NULL) arena->prev->next = arena->next;
+	else class->available = arena->next;
+	if (arena->next != NULL) arena->next->prev = arena->prev;
+	arena->prev = arena->next = NULL;
+}
+
+static struct Arena* create_arena(size_t size_class) {
+	void *memory;
+	if (posix_memalign(&memory, ARENA_SIZE, ARENA_SIZE) != 0) {
+		return NULL;
+	}
+	struct Arena *arena = memory;
+	arena->free_blocks = NULL;
+	arena->unused = (char*)arena + arena_header_size;
+	arena->num_blocks = 0;
+	arena->size_class = size_class;
+	arena->counters = NULL;
+	link_arena(&classes[size_class], arena);
+	classes[size_class].num_arenas++;
+	stats.num_arenas++;
+	return arena;
+}
+
+static void release_arena(struct Arena *arena) {
+	struct SizeClass *class = &classes[arena->size_class];
+	unlink_arena(class, arena);
+	class->num_arenas--;
+	stats.num_arenas--;
+	free(arena->counters);
+	free(arena);
+}
+
+void* allocate_block(size_t size, size_t *usable_size) {
+	size_t size_class = class_of(size);
+	struct Arena *arena = classes[size_class].available;
+	if (arena == NULL) {
+		arena = create_arena(size_class);
+		if (arena == NULL) return NULL;
+	}
+	void *block = arena->free_blocks;
+	if (block != NULL) {
+		arena->free_blocks = *(void**)block;
+	} else {
+		block = arena->unused;
+		arena->unused += class_sizes[size_class];
+	}
+	if (++arena->num_blocks == arena_capacity(size_class)) {
+		unlink_arena(&classes[size_class], arena);
+	}
+	*usable_size = class_sizes[size_class];
+	stats.num_blocks++;
+	stats.block_bytes += class_sizes[size_class];
+	stats.num_allocations++;
+	return block;
+}
+
+/**
+ * An arena whose blocks are all free again is released, unless it is the
+ * only arena of its class with free blocks left. That keeps alternating
+ * allocations and frees from creating and releasing an arena each time.
+ */
+void free_block(void *block, size_t size) {
+	struct Arena *arena = arena_of(block);
+	struct SizeClass *class = &classes[arena->size_class];
+	assert (size <= class_sizes[arena->size_class]);
+	if (arena->num_blocks-- == arena_capacity(arena->size_class)) {
+		link_arena(class, arena);
+	}
+	*(void**)block = arena->free_blocks;
+	arena->free_blocks = block;
+	stats.num_blocks--;
+	stats.block_bytes -= class_sizes[arena->size_class];
+	stats.num_frees++;
+	if (arena->num_blocks == 0 and (arena->prev != NULL or arena->next != NULL)) {
+		release_arena(arena);
+	}
+}
+
+uint32_t* counter_of_block(void *block) {
+	struct Arena *arena = arena_of(block);
+	size_t size = class_sizes[arena->size_class];
+	if (arena->counters == NULL) {
+		arena->counters = calloc(arena_capacity(arena->size_class), sizeof(*arena->counters));
+	}
+	return &arena->counters[((char*)block - ((char*)arena + arena_header_size)) / size];
+}
+
+void get_allocator_stats(struct AllocatorStats *result) {
+	*result = stats;
+	result->arena_bytes = stats.num_arenas * ARENA_SIZE;
+}
@@ -12,22 +12,37 @@
 /******************************************************************************
  * MARK: Dependencies
  * Requires ISO C90, hosted implementation of C standard library,
- * libncurses-dev, POSIX getopt.
+ * libncurses-dev (ncursesw), POSIX getopt, the POSIX file APIs (open, mmap),
+ * wcwidth and pthreads.
  * Other than that it is a self-contained single-source file program.
  *****************************************************************************/
 
+#define _XOPEN_SOURCE 700
+
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <iso646.h>
+#include <limits.h>
+#include <locale.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <pthread.h>
 #include <regex.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
 
 /******************************************************************************
  * MARK: Config
@@ -38,6 +53,7 @@ struct Config {
 	const char *theme;
 	int tabsize;
 	bool stream_file_contents;
+	size_t history_limit;  /* bytes of undo history kept in memory */
 };
 
 /**
@@ -50,41 +66,180 @@ extern struct Config config;
  */
 extern void parse_arguments(int argc, char *argv[]);
 
+/******************************************************************************
+ * MARK: Allocator
+ * Lines are allocated from size classes of fixed-size blocks. The blocks
+ * of a class are carved from large arenas, which are given back as a whole
+ * once all of their blocks are free. Not thread-safe: lines are only
+ * allocated and freed by the main thread.
+ *****************************************************************************/
+
+#define NUM_SIZE_CLASSES 17
+#define ARENA_SIZE (1 << 20)
+
+struct AllocatorStats {
+	size_t num_blocks;  /* blocks in use */
+	size_t block_bytes;  /* bytes of the blocks in use */
+	size_t num_arenas;
+	size_t arena_bytes;  /* bytes reserved by the arenas */
+	size_t num_allocations;  /* since program start */
+	size_t num_frees;
+};
+
+/**
+ * Allocates a block of at least size bytes from the smallest size class
+ * that fits and stores the actual size of the block in *usable_size.
+ * Size must not exceed the largest size class (4104 bytes).
+ */
+extern void* allocate_block(size_t size, size_t *usable_size);
+
+/**
+ * Returns a block to its arena. Size is any size within the block's class,
+ * such as the size it was requested with or its usable size.
+ */
+extern void free_block(void *block, size_t size);
+
+/**
+ * Returns a counter that belongs to the block, zero unless it was set.
+ * It must be zero again when the block is freed. The counters of an
+ * arena are allocated when one of them is first needed.
+ */
+extern uint32_t* counter_of_block(void *block);
+
+/**
+ * Retrieves the current allocation statistics.
+ */
+extern void get_allocator_stats(struct AllocatorStats *stats);
+
 /******************************************************************************
  * MARK: Line
  *****************************************************************************/
 
 /**
  * A character array for representing lines in a document.
- * Line length is limited to UINT16_MAX (65535) because longer
- * lines do not make much sense when dealing with text documents.
  * The actual string of characters begins after sizeof(struct Line).
+ * It is a gap buffer: the unused capacity sits at the position of
+ * the last edit, so that typing only moves the characters between
+ * consecutive edit positions instead of the rest of the line.
+ * Lines longer than LINE_CHUNK_SIZE become a struct LongLine,
+ * and views are a struct LineView. Their header length is zero,
+ * so use length_of for the length of any line.
+ * Lines are frozen while a snapshot that refers to them is in use,
+ * see begin_line_snapshot.
  */
 struct Line {
 	uint16_t length;
-	uint16_t capacity;
+	uint16_t capacity;  /* zero for views, LONG_LINE_CAPACITY for long lines */
+	uint16_t gap;  /* position of the unused capacity */
+	uint16_t generation;  /* of snapshots, when the line was created */
+};
+
+/**
+ * Maximum number of characters of a plain struct Line.
+ */
+#define LINE_CHUNK_SIZE 4096
+#define LONG_LINE_CAPACITY UINT16_MAX
+
+/**
+ * A line that refers to text it does not own, such as the read-only
+ * mapping of the file a document was loaded from. Views are replaced
+ * by a private copy when they are modified for the first time.
+ */
+struct LineView {
+	struct Line line;
+	const char *text;
+	size_t length;
+};
+
+/**
+ * A line of arbitrary length, stored as a sequence of plain lines of at
+ * most LINE_CHUNK_SIZE characters. The position of each chunk is kept
+ * in starts, so a column is found by binary search and only the chunk
+ * holding it is touched.
+ */
+struct LongLine {
+	struct Line line;
+	size_t length;
+	struct Line **chunks;
+	size_t *starts;  /* position of the first character of each chunk */
+	size_t num_chunks;
+	size_t capacity;
 };
 
 /**
- * Retrieves the string of characters from the given line.
+ * Returns the number of characters of the line.
  */
-extern char* text_of(struct Line *line);
+extern size_t length_of(struct Line *line);
 
 /**
- * Clears a line from the given start position to line end.
+ * Retrieves the character at the given position of the line.
  */
-extern void clear_line(struct Line *line, size_t start);
+extern int character_of(struct Line *line, size_t position);
+
+/**
+ * Retrieves the longest contiguous run of characters of the line which
+ * starts at the given position and stores its length in *length.
+ */
+extern const char* segment_of(struct Line *line, size_t position, size_t *length);
+
+/**
+ * Shortens the line to the given length.
+ */
+extern void truncate_line(struct Line **lineptr, size_t length);
 
 /**
  * Creates a new empty line.
  */
 extern struct Line* create_line(void);
 
+/**
+ * Creates a new line holding a copy of the given text.
+ * The line is allocated once at its exact size.
+ */
+extern struct Line* create_line_from_text(const char *text, size_t length);
+
+/**
+ * Creates a view onto text owned by someone else.
+ */
+extern struct Line* create_line_view(const char *text, size_t length);
+
 /**
  * Frees the allocated memory of the given line.
  */
 extern void free_line(struct Line *line);
 
+/**
+ * Freezes the lines created so far for a snapshot which another thread
+ * reads. Until end_line_snapshot, frozen lines must be passed through
+ * unshare_line before they are modified, and free_line sets them aside.
+ * Returns false if the generations of lines ran out, in which case every
+ * line still in use must be passed to age_line before the snapshot is.
+ */
+extern bool begin_line_snapshot(void);
+
+/**
+ * Thaws all lines and frees those that were set aside.
+ */
+extern void end_line_snapshot(void);
+
+/**
+ * Replaces a frozen or shared line by a copy that may be modified.
+ */
+extern void unshare_line(struct Line **lineptr);
+
+/**
+ * Adds an owner to the line, such as a clip of the clipboard holding it
+ * next to the document. Shared lines must be passed through unshare_line
+ * before they are modified, free_line only frees them with their last
+ * owner. Returns the line.
+ */
+extern struct Line* share_line(struct Line *line);
+
+/**
+ * Moves a line into the oldest generation.
+ */
+extern void age_line(struct Line *line);
+
 /**
  * Inserts a character at the given position into the line.
  */
@@ -100,28 +255,144 @@ extern void append_character(struct Line **lineptr, int ch);
  */
 extern void append_string(struct Line **lineptr, const char *text);
 
+/**
+ * Appends length characters of text to the given line.
+ */
+extern void append_text(struct Line **lineptr, const char *text, size_t length);
+
+/**
+ * Appends the characters of source from position on to the given line.
+ */
+extern void append_line_text(struct Line **lineptr, struct Line *source, size_t position);
+
 /**
  * Removes the character at the given position from the line.
  */
 extern void remove_character(struct Line **lineptr, size_t position);
 
 /**
- * Reads a line from a file stream.
+ * Inserts length characters of text at the given position into the line.
+ */
+extern void insert_characters(struct Line **lineptr, size_t position, const char *text, size_t length);
+
+/**
+ * Removes n characters from the given position on from the line.
  */
-extern struct Line* read_line_from_file(FILE *fp);
+extern void remove_characters(struct Line **lineptr, size_t position, size_t n);
+
+/******************************************************************************
+ * MARK: Unicode
+ * Text is UTF-8. Positions within lines stay byte offsets, characters
+ * are stepped over as a whole and drawn in their display width.
+ *****************************************************************************/
+
+/**
+ * Returns the number of bytes at the start of text that are ASCII.
+ */
+extern size_t count_ascii(const char *text, size_t n);
+
+/**
+ * Decodes the UTF-8 encoded codepoint at the start of text, which holds
+ * n > 0 bytes, and returns its length. Invalid bytes are decoded one by
+ * one as U+FFFD.
+ */
+extern size_t decode_character(const char *text, size_t n, uint32_t *codepoint);
+
+/**
+ * Returns the number of terminal cells the codepoint takes, which is zero
+ * for those drawn on top of the character before them.
+ */
+extern int character_width(uint32_t codepoint);
+
+/**
+ * Decodes the codepoint at the given position of the line and stores the
+ * number of its bytes in *length.
+ */
+extern uint32_t codepoint_at(struct Line *line, size_t position, size_t *length);
+
+/**
+ * Returns the position after the character at the given position, which
+ * includes the combining marks and joined codepoints that follow it.
+ */
+extern size_t next_character(struct Line *line, size_t position);
+
+/**
+ * Returns the position of the character before the given position.
+ */
+extern size_t previous_character(struct Line *line, size_t position);
 
 /******************************************************************************
  * MARK: Document
  *****************************************************************************/
 
+/**
+ * A page of consecutive lines. The pages of a streamed document are read
+ * from the file on demand and dropped again when too many are resident,
+ * unless they have been edited since the document was last saved.
+ */
+struct LinePage {
+	struct Line **lines;  /* NULL while the page is not resident */
+	size_t num_lines;
+	size_t capacity;
+	struct LinePage *prev, *next;  /* neighbouring pages in the document */
+	off_t offset;  /* position of the page within the streamed file */
+	size_t size;  /* number of bytes the page spans within the file */
+	bool is_tail;  /* the page spans until the end of the file */
+	bool is_pinned;  /* edited, so the page cannot be read again */
+	size_t num_bytes;  /* of its lines, each counted with a newline */
+	bool is_resized;  /* edited since its bytes were summed, see edit_line */
+	struct LinePage *newer, *older;  /* resident pages in order of use */
+};
+
 /**
  * Models a text document
  */
 struct TextDocument {
 	char *path;
-	struct Line **lines;
+	void *root;  /* page tree, see struct PageNode */
+	int height;  /* zero if the root is a page */
+	struct LinePage *first_page, *last_page;
+	size_t num_pages;
 	size_t num_lines;
-	size_t capacity;
+	size_t num_bytes;  /* of its lines, each counted with a newline */
+	size_t *resized_lines;  /* a line of every resized page */
+	size_t num_resized_lines;
+	size_t resized_capacity;
+	struct LinePage *recent_page;  /* most recently accessed page */
+	size_t recent_first_line;  /* index of its first line */
+	struct LinePage *loading_page;  /* page being filled while loading */
+	struct DocumentStream *stream;  /* NULL unless streamed on demand */
+	struct DocumentSave *save;  /* NULL unless saving in the background */
+	size_t version;  /* counts modifications */
+	const char *mapping;  /* read-only file contents viewed by the lines */
+	size_t mapping_size;
+};
+
+/**
+ * Number of lines per page when loading a document.
+ * Pages are split once they have grown to twice that size.
+ */
+#define LINES_PER_PAGE 1024
+
+/**
+ * Maximum number of children of a page tree node.
+ */
+#define PAGE_NODE_FANOUT 32
+
+/**
+ * Inner node of the B+tree holding the pages of a document.
+ * Its children are pages at height 1 and nodes above.
+ * Every child is annotated with its number of lines and bytes, so lines
+ * are found, inserted and removed by index, and found by byte offset, in
+ * logarithmic time.
+ */
+struct PageNode {
+	void *children[PAGE_NODE_FANOUT];
+	size_t counts[PAGE_NODE_FANOUT];  /* number of lines per child */
+	size_t sizes[PAGE_NODE_FANOUT];  /* number of bytes per child */
+	size_t num_children;
+	size_t num_lines;
+	size_t num_bytes;
 };
 
 /**
@@ -135,9 +406,11 @@ extern struct TextDocument* open_document(const char *path);
 extern void close_document(struct TextDocument *document);
 
 /**
- *
+ * Gives the line views of a mapped document private copies of the pages
+ * they refer to, so that the file can be overwritten. Returns false if
+ * the mapping could not be copied.
  */
-extern void save_document(struct TextDocument *document);
+extern bool detach_document_mapping(struct TextDocument *doc);
 
 /**
  *
@@ -154,17 +427,643 @@ extern void append_line(struct TextDocument **docptr, struct Line *line);
  */
 extern void remove_line(struct TextDocument **docptr, size_t index);
 
+/**
+ * Inserts n lines at index at once.
+ */
+extern void insert_lines(struct TextDocument **docptr, size_t index, struct Line **lines, size_t n);
+
+/**
+ * Removes n lines starting at index at once. Unlike remove_line,
+ * the lines are freed.
+ */
+extern void remove_lines(struct TextDocument **docptr, size_t index, size_t n);
+
+/**
+ * Inserts text, which may span several lines, at the given line and column.
+ * The new lines are split off in one pass and inserted all at once.
+ * The line and column are moved to the end of the inserted text.
+ */
+extern void insert_text(struct TextDocument **docptr, size_t *line, size_t *column, const char *text, size_t length);
+
+/**
+ * Inserts text given as n > 1 lines, which may be shared, like insert_text.
+ * The document takes over the lines.
+ */
+extern void insert_text_lines(struct TextDocument **docptr, size_t *line, size_t *column, struct Line **lines, size_t n);
+
+/**
+ * Deletes the text from the start line and column up to, but excluding,
+ * the end line and column.
+ */
+extern void delete_range(
+	struct TextDocument **docptr,
+	size_t start_line, size_t start_column,
+	size_t end_line, size_t end_column
+);
+
+/**
+ * Returns a copy of the text from the start line and column up to, but
+ * excluding, the end line and column, with lines separated by newlines.
+ * Stores its length in *length. The copy must be freed by the caller.
+ */
+extern char* copy_text(
+	struct TextDocument *doc,
+	size_t start_line, size_t start_column,
+	size_t end_line, size_t end_column,
+	size_t *length
+);
+
+/**
+ * Returns the line at index for reading. Pages the line in if necessary.
+ */
+extern struct Line** get_line(struct TextDocument *doc, size_t index);
+
+/**
+ * Returns the line at index for modification. The page holding the line
+ * is pinned in memory until the document is saved. Its number of bytes
+ * is summed again when it is next needed, after the line was modified.
+ */
+extern struct Line** edit_line(struct TextDocument *doc, size_t index);
+
+/**
+ * Splits a buffer into lines and passes their text to the consumer. Unless
+ * this is the final buffer, the trailing incomplete line is left alone.
+ * Returns the number of consumed bytes.
+ */
+extern size_t split_lines(
+	const char *data, size_t size, bool is_final,
+	void (*consume)(void *context, const char *text, size_t length), void *context
+);
+
+/******************************************************************************
+ * MARK: Page tree
+ *****************************************************************************/
+
+/**
+ * Creates an empty, resident page with room for capacity lines.
+ */
+extern struct LinePage* create_page(size_t capacity);
+
+/**
+ * Frees a page including its lines.
+ */
+extern void free_page(struct LinePage *page);
+
+/**
+ * Returns the page holding the line at index along with the index of the
+ * first line of that page. Indices past the end map to the last page.
+ */
+extern struct LinePage* find_page(struct TextDocument *doc, size_t index, size_t *first_line);
+
+/**
+ * Appends a page to the end of the document.
+ */
+extern void append_page(struct TextDocument *doc, struct LinePage *page);
+
+/**
+ * Inserts the line into the page tree, splitting full pages.
+ */
+extern void insert_page_line(struct TextDocument *doc, size_t index, struct Line *line);
+
+/**
+ * Removes the line at index from the page tree and returns it.
+ * Pages running empty are dropped, small neighbours merged.
+ */
+extern struct Line* remove_page_line(struct TextDocument *doc, size_t index);
+
+/**
+ * Inserts n lines at index. Large batches are put into new pages that are
+ * spliced in after the page at index, then the inner nodes are rebuilt.
+ */
+extern void insert_page_lines(struct TextDocument *doc, size_t index, struct Line **lines, size_t n);
+
+/**
+ * Removes and frees n lines starting at index. Pages covered entirely
+ * are dropped without reading them, then the inner nodes are rebuilt.
+ */
+extern void remove_page_lines(struct TextDocument *doc, size_t index, size_t n);
+
+/**
+ * Frees the whole page tree including all lines.
+ */
+extern void free_page_tree(struct TextDocument *doc);
+
+/**
+ * Notes that the line at index of the page is about to change its length.
+ * The bytes of the page are summed again before the tree is next used.
+ */
+extern void mark_page_resized(struct TextDocument *doc, struct LinePage *page, size_t index);
+
+/**
+ * Returns the byte offset in the file of the start of the line at index.
+ * Indices past the end map to the end of the file.
+ */
+extern size_t offset_of_line(struct TextDocument *doc, size_t index);
+
+/**
+ * Returns the index of the line holding the byte at offset in the file
+ * and stores the offset of its start in *line_offset. Offsets past the
+ * end map to the last line.
+ */
+extern size_t line_at_offset(struct TextDocument *doc, size_t offset, size_t *line_offset);
+
+/**
+ * Returns the number of bytes the document takes in a file.
+ */
+extern size_t size_of_document(struct TextDocument *doc);
+
+/******************************************************************************
+ * MARK: Stream
+ *****************************************************************************/
+
+/**
+ * Location of a page within the streamed file
+ */
+struct PageExtent {
+	off_t offset;
+	size_t size;
+	size_t num_lines;
+	bool is_tail;
+};
+
+/**
+ * Incremental line counter over a file,
+ * producing one page extent per LINES_PER_PAGE lines.
+ */
+struct PageScanner {
+	int fd;
+	char *buffer;
+	size_t length;  /* number of bytes in buffer */
+	size_t position;  /* scan position within buffer */
+	off_t buffer_offset;  /* file offset of buffer */
+	off_t line_offset;  /* file offset of the current line */
+	off_t page_offset;  /* file offset of the current page */
+	size_t num_lines;  /* lines counted in the current page */
+};
+
+/**
+ * Backs a document with a file that is read page by page. A background
+ * thread builds the sparse page index while the first page is on screen.
+ */
+struct DocumentStream {
+	int fd;
+	pthread_t indexer;
+	pthread_mutex_t lock;
+	struct PageScanner scanner;
+	struct PageExtent *extents;  /* indexed, not yet adopted (locked) */
+	size_t num_extents;  /* (locked) */
+	size_t capacity;  /* (locked) */
+	bool is_indexing;  /* indexer thread is still running (locked) */
+	pthread_cond_t is_indexed;  /* signalled when it stops */
+	bool is_cancelled;  /* indexer thread should stop (locked) */
+	bool is_joinable;  /* indexer thread has not been joined yet */
+	bool is_complete;  /* all extents have been adopted by the document */
+	off_t adopted_size;  /* of the file up to the end of the adopted extents */
+	struct LinePage *newest, *oldest;  /* resident pages that are unpinned */
+	size_t num_resident;
+};
+
+/**
+ * Maximum number of unpinned pages of a streamed document kept in memory.
+ */
+#define MAX_RESIDENT_PAGES 64
+
+/**
+ * Starts streaming the file behind fd into the document, which must not
+ * contain any pages yet. The first page is resident upon return.
+ * Takes ownership of fd.
+ */
+extern void open_document_stream(struct TextDocument *doc, int fd);
+
+/**
+ * Stops the indexer thread and releases the stream.
+ */
+extern void close_document_stream(struct TextDocument *doc);
+
+/**
+ * Appends the pages indexed so far to the document.
+ * Returns false once the whole file has been indexed.
+ */
+extern bool update_document_stream(struct TextDocument *doc);
+
+/**
+ * Blocks until the whole file has been indexed.
+ */
+extern void finish_document_stream(struct TextDocument *doc);
+
+/**
+ * Blocks until the indexer thread has stopped and returns the size of the
+ * file it indexed. Unlike the other functions, this may be called from
+ * another thread.
+ */
+extern off_t wait_for_stream_index(struct DocumentStream *stream);
+
+/**
+ * Reads a page from the file and marks it as most recently used.
+ * Drops the least recently used pages beyond MAX_RESIDENT_PAGES.
+ */
+extern void load_page(struct TextDocument *doc, struct LinePage *page);
+
+/**
+ * Marks a resident page as most recently used.
+ */
+extern void touch_page(struct TextDocument *doc, struct LinePage *page);
+
+/**
+ * Keeps a page in memory until the document is saved.
+ */
+extern void pin_page(struct TextDocument *doc, struct LinePage *page);
+
+/**
+ * Copies the contents of a page that is not resident from the file behind
+ * source to fd, without the newline terminating its last line.
+ */
+extern bool copy_extent(int source, const struct PageExtent *extent, int fd);
+
+/**
+ * Switches the stream over to the freshly saved file at the document path.
+ * Page offsets must have been updated to the new file. Unpins all pages.
+ */
+extern void reopen_document_stream(struct TextDocument *doc);
+
+/******************************************************************************
+ * MARK: Save
+ *****************************************************************************/
+
+/**
+ * A page as it was when a save began: its lines,
+ * or where it is in the file if it was not resident.
+ */
+struct PageSnapshot {
+	struct Line **lines;  /* NULL if not resident */
+	size_t num_lines;
+	struct PageExtent extent;
+};
+
+/**
+ * Outcome of saving a document.
+ */
+struct SaveReport {
+	off_t size;  /* bytes written */
+	double seconds;
+	int error;  /* errno of the first failure, zero if saved */
+	bool has_later_edits;  /* the document was modified during the save */
+};
+
+/**
+ * Writes a snapshot of a document on a background thread, so that the
+ * document can be edited meanwhile. The lines of the snapshot are frozen
+ * until the save has ended.
+ */
+struct DocumentSave {
+	pthread_t writer;
+	pthread_mutex_t lock;
+	struct timespec start;
+	char *path;  /* with symbolic links resolved */
+	mode_t mode;  /* of the saved file */
+	uid_t owner;
+	gid_t group;
+	bool is_in_place;  /* for files with other hard links */
+	int source;  /* file of a streamed document */
+	struct DocumentStream *stream;  /* if it was still being indexed */
+	struct PageExtent rest;  /* of the source not indexed yet, if so */
+	off_t rest_offset;  /* in the saved file */
+	struct PageSnapshot *pages;
+	size_t num_pages;
+	size_t version;  /* of the document in the snapshot */
+	struct PageExtent *extents;  /* of the pages in the saved file */
+	struct SaveReport report;  /* (locked) */
+	bool is_finished;  /* (locked) */
+};
+
+/**
+ * Takes a snapshot of the document and starts writing it to the document
+ * path. Either the complete snapshot is saved or the file is left unchanged,
+ * except for files with other hard links, which are overwritten in place.
+ */
+extern void begin_document_save(struct TextDocument *doc);
+
+/**
+ * Ends a save that has finished writing and reports its outcome.
+ * Returns false if no save has finished.
+ */
+extern bool update_document_save(struct TextDocument *doc, struct SaveReport *report);
+
+/**
+ * Blocks until a running save has finished and reports its outcome.
+ */
+extern void finish_document_save(struct TextDocument *doc, struct SaveReport *report);
+
+/**
+ * Saves the document and waits for it.
+ */
+extern bool save_document(struct TextDocument *doc, struct SaveReport *report);
+
+/******************************************************************************
+ * MARK: Replace
+ *****************************************************************************/
+
+/**
+ * Text replacing length characters of a line from column on. Replacements
+ * are sorted by position and do not overlap, their columns are those from
+ * before any of them is applied. Neither side contains newlines.
+ */
+struct Replacement {
+	size_t line, column;
+	size_t length;
+	const char *text;
+	size_t text_length;
+};
+
+/**
+ * Applies the replacements to the document. Every line they touch is
+ * rebuilt once at its final size, and large batches of lines in parallel.
+ */
+extern void replace_text(struct TextDocument *doc, const struct Replacement *replacements, size_t n);
+
+/******************************************************************************
+ * MARK: History
+ *****************************************************************************/
+
+/**
+ * Records text inserted into the document of the editor. Typing continued
+ * at the end of the last change extends it, unless it spans several lines.
+ */
+extern void record_insertion(size_t line, size_t column, const char *text, size_t length);
+
+/**
+ * Records the deletion of the text from the start line and column up to,
+ * but excluding, the end line and column, before it is deleted.
+ * Consecutive deletions of single characters are merged.
+ */
+extern void record_deletion(size_t line, size_t column, size_t end_line, size_t end_column);
+
+/**
+ * Records replacements before they are applied, as a single change.
+ */
+extern void record_replacements(const struct Replacement *replacements, size_t n);
+
+/**
+ * Makes the next change start an entry of its own, e.g. for a paste.
+ */
+extern void seal_history(void);
+
+/**
+ * Reverts the last change and stores the position where it was.
+ * Returns false if there is nothing to undo.
+ */
+extern bool undo_change(size_t *line, size_t *column);
+
+/**
+ * Applies the last change that was undone again.
+ * Returns false if there is nothing to redo.
+ */
+extern bool redo_change(size_t *line, size_t *column);
+
+/**
+ *
+ */
+extern void clear_history(void);
+
+/******************************************************************************
+ * MARK: Search
+ *****************************************************************************/
+
+/**
+ * Maximum length of a search pattern.
+ */
+#define SEARCH_PATTERN_SIZE 128
+
+/**
+ * Position of a match in the document of the editor (normalized).
+ */
+struct SearchMatch {
+	size_t line, column;
+	bool is_found;
+};
+
+/**
+ * Position and length of a match in the document of the editor (normalized).
+ */
+struct IndexedMatch {
+	size_t line, column;
+	size_t length;
+};
+
+/**
+ * Starts a search at the given position with an empty pattern.
+ */
+extern void begin_search(size_t line, size_t column);
+
+/**
+ * Changes the pattern and returns its first match after the position the
+ * search began at, wrapping around at the end of the document, or NULL if
+ * the pattern is empty or not a valid regex. Matches of the parts the old
+ * and the new text share are reused, so typing one character more only
+ * scans from the last match on. Regexes are POSIX extended ones, matched
+ * line by line.
+ */
+extern const struct SearchMatch* update_search(const char *pattern, size_t length, bool is_regex);
+
+/**
+ * Finds the next match after the given position, wrapping around. Uses
+ * the match index as far as it is filled in, and scans beyond it.
+ * Returns false if there is none or no pattern.
+ */
+extern bool find_next_match(size_t line, size_t column, struct SearchMatch *match);
+
+/**
+ * Clears the pattern, so that no more matches are highlighted,
+ * and stops the threads of the search.
+ */
+extern void end_search(void);
+
+/**
+ * Fills in the match index of the pattern for a moment. The document is
+ * split into pages which a pool of threads, one per processor, scans in
+ * parallel. Returns true if there is more to do.
+ */
+extern bool update_match_index(void);
+
+/**
+ * Returns true until the match index is complete.
+ */
+extern bool is_indexing_matches(void);
+
+/**
+ * Completes the match index and returns all matches, sorted by position.
+ * The matches stay valid until the search changes.
+ */
+extern const struct IndexedMatch* list_matches(size_t *n);
+
+/**
+ * Returns all matches of another pattern, sorted by position, in an array
+ * to be freed by the caller. The search and its matches are left as they
+ * are.
+ */
+extern struct IndexedMatch* collect_matches(const char *pattern, size_t length, bool is_regex, size_t *n);
+
+/**
+ * Returns the number of matches indexed so far and stores the number of
+ * the match at the given position in *number, or zero if there is none.
+ */
+extern size_t count_matches(size_t line, size_t column, size_t *number);
+
+/**
+ * Updates the match index for an edit of the given document which
+ * replaced removed lines from line on by inserted lines. The matches of
+ * the edited lines are dropped and the lines scanned again later.
+ */
+extern void invalidate_matches(struct TextDocument *doc, size_t line, size_t removed, size_t inserted);
+
+/**
+ * Drops the matches from line on, to scan the lines in the background
+ * again. Cheaper than invalidating many edited lines one by one.
+ */
+extern void reindex_matches(struct TextDocument *doc, size_t line);
+
+/**
+ * Finds the first match of the pattern within the line with the given
+ * index (normalized) that ends after from and starts before to. Stores
+ * its columns in *start and *end. Lines that were indexed already are
+ * looked up in the index instead of being scanned.
+ */
+extern bool find_line_match(size_t index, struct Line *line, size_t from, size_t to, size_t *start, size_t *end);
+
+/******************************************************************************
+ * MARK: Highlight
+ *****************************************************************************/
+
+enum TokenKind {
+	TOKEN_TEXT,
+	TOKEN_KEYWORD,
+	TOKEN_TYPE,
+	TOKEN_STRING,
+	TOKEN_NUMBER,
+	TOKEN_COMMENT,
+	TOKEN_DIRECTIVE,
+	NUM_TOKEN_KINDS
+};
+
+/**
+ * Color pair of the theme, which plain text is drawn in. Those of the
+ * other kinds of tokens follow it.
+ */
+#define TOKEN_COLOR_PAIR 10
+
+/**
+ * Characters of a line from column on, up to the next run, are tokens of
+ * the same kind.
+ */
+struct TokenRun {
+	size_t column;
+	enum TokenKind kind;
+};
+
+/**
+ * Starts highlighting the document of the editor, if it is C or C++.
+ */
+extern void begin_highlight(void);
+
+/**
+ * Frees the lexer states and cached runs.
+ */
+extern void end_highlight(void);
+
+/**
+ * Colors tokens on the given background, for terminals with colors.
+ */
+extern void init_token_colors(short background);
+
+/**
+ * Returns the attributes tokens of the kind are drawn with.
+ */
+extern attr_t token_attribute(enum TokenKind kind);
+
+/**
+ * Picks up the lines the highlight worker lexed, marks those whose
+ * highlighting changed as damaged and hands it the next ones. Lines on
+ * the screen are lexed first, then the rest of the document. The lexer
+ * state at the end of every line is kept, so only lines that were edited
+ * and those after them up to where the state is the same as before are
+ * lexed again. Results for an older version of the document are dropped.
+ */
+extern void update_highlight(void);
+
+/**
+ * Returns true while the highlight worker has lines to lex, whose
+ * results are picked up by update_highlight.
+ */
+extern bool is_highlighting(void);
+
+/**
+ * Returns the token runs of a line of the document of the editor
+ * (normalized). Lines that were not lexed yet are plain text, edited
+ * lines keep their old runs until they were lexed again.
+ */
+extern const struct TokenRun* highlight_line(size_t index, size_t *n);
+
+/**
+ * Updates the lexer states for an edit of the given document which
+ * replaced removed lines from line on by inserted lines.
+ */
+extern void invalidate_highlight(struct TextDocument *doc, size_t line, size_t removed, size_t inserted);
+
+/**
+ * Returns the number of lines lexed so far.
+ */
+extern size_t count_lexed_lines(void);
+
+/******************************************************************************
+ * MARK: Columns
+ *****************************************************************************/
+
+/**
+ * Returns the screen column at which the character at the given position
+ * of a line of the document of the editor (both normalized) is drawn, if
+ * the line was drawn from its start. Tabs advance to the next multiple of
+ * config.tabsize. Long lines keep checkpoints of their columns, so this
+ * does not walk the line from its start.
+ */
+extern size_t screen_column_of(size_t index, size_t position);
+
+/**
+ * Returns the position of the character of a line drawn at the given
+ * screen column, or the length of the line if it ends before it.
+ */
+extern size_t position_at_screen_column(size_t index, size_t column);
+
+/**
+ * Drops the checkpoints of lines touched by an edit of the given document
+ * which replaced removed lines from line on by inserted lines.
+ */
+extern void invalidate_columns(struct TextDocument *doc, size_t line, size_t removed, size_t inserted);
+
+/**
+ * Keeps the checkpoints of a line that was just edited from the given
+ * position on, which edit_line dropped. Lets typing in a long line keep
+ * the checkpoints before the cursor.
+ */
+extern void keep_columns_before(struct TextDocument *doc, size_t line, size_t position);
+
+/**
+ * Drops the checkpoints of all lines.
+ */
+extern void clear_columns(void);
+
 /******************************************************************************
  * MARK: Clipboard
  *****************************************************************************/
 
 /**
  * Clears the clipboard contents and frees allocated clipboard memory.
+ * Clips share lines with the document, so this precedes closing it.
  */
 extern void clear_clipboard(void);
 
 /**
- * Copies the currently selected text to the clipboard.
+ * Copies the currently selected text to the clipboard as its newest clip.
+ * Whole lines are shared with the document rather than copied.
  */
 extern void copy_current_selection(void);
 
@@ -184,6 +1083,12 @@ extern void select_everything(void);
  */
 extern void paste_clipboard(void);
 
+/**
+ * Replaces the text pasted last, if nothing was changed since, by the clip
+ * copied before it. Repeating this cycles through the clipboard.
+ */
+extern void paste_older_clip(void);
+
 /**
  *
  */
@@ -249,17 +1154,8 @@ struct Cursor {
 extern struct Cursor cursor;
 
 /**
- * Stores the cursor position
- */
-extern void push_cursor(void);
-
-/**
- * Restores the cursor position
- */
-extern void pop_cursor(void);
-
-/**
- *
+ * Computes the screen position of a document position. The cursor is
+ * moved there when the editor is rendered.
  */
 extern void update_cursor(size_t line_number, size_t column_number);
 
@@ -273,16 +1169,6 @@ extern void update_current_cursor(void);
  */
 extern void update_cursor_reverse(int y, int x);
 
-/**
- *
- */
-extern void print_title_bar(void);
-
-/**
- *
- */
-extern void print_status_bar(void);
-
 /**
  * Subtracts 1 from the index.
  * Applicable to line numbers and column numbers, both
@@ -299,9 +1185,9 @@ struct DocumentEditor {
 	int x, y;
 	int width, height;
 	size_t line_offset;
-	size_t column_offset;
+	size_t column_offset;  /* screen column shown first, tabs expanded */
 	size_t line;
-	uint16_t column;
+	size_t column;
 	bool was_modified;
 };
 
@@ -322,11 +1208,32 @@ extern void open_document_editor(void);
  */
 extern void close_document_editor(void);
 
+/**
+ * Picks up progress of background work on the document.
+ */
+extern void poll_document_editor(void);
+
+/**
+ * Makes input time out periodically while there is background work
+ * on the document to poll for.
+ */
+extern void update_input_timeout(void);
+
+/**
+ * Starts saving the document. The outcome is reported in the status bar.
+ */
+extern void save_document_editor(void);
+
 /**
  *
  */
 extern struct Line** line_at(size_t index);
 
+/**
+ * Like line_at, but announces that the line is about to be modified.
+ */
+extern struct Line** edit_line_at(size_t index);
+
 /**
  *
  */
@@ -345,47 +1252,130 @@ extern int current_character(int n);
 /**
  *
  */
-extern void print_title_bar(void);
+extern void insert_character_at_current_position(int ch);
 
 /**
- *
+ * Inserts text, which may span several lines, at the cursor and moves the
+ * cursor behind it. Signalling the modification and repainting is left to
+ * the caller, so that batches of text are signalled once.
  */
-extern void print_status_bar(void);
+extern void insert_text_at_current_position(const char *text, size_t length);
 
 /**
- *
+ * Deletes the character under the cursor, with its combining marks.
+ */
+extern void delete_character_at_current_position(void);
+
+/**
+ * Deletes the text from the line and column up to, but excluding, the
+ * end line and column as a change of its own and moves the cursor to
+ * where it began. The lines in between are dropped in bulk.
+ */
+extern void delete_text_range(size_t line, size_t column, size_t end_line, size_t end_column);
+
+/**
+ * Starts searching from the current position.
+ */
+extern void begin_search_at_current_position(void);
+
+/**
+ * Searches for the pattern and moves to its first match, or back to where
+ * the search began if there is none. Returns false in that case.
+ */
+extern bool search_from_current_position(const char *pattern, size_t length, bool is_regex);
+
+/**
+ * Moves back to where the search began and stops highlighting matches.
+ */
+extern void cancel_search(void);
+
+/**
+ * Moves to the next match of the last pattern.
+ */
+extern bool move_to_next_match(void);
+
+/**
+ * Replaces all occurrences of the pattern by the text as one change that
+ * is undone at once, moves to the first one and reports how many there
+ * were and how long it took. A streamed document is indexed to its end first.
+ */
+extern void replace_all_matches(const char *pattern, size_t length, const char *text, size_t text_length);
+
+/**
+ * Reverts the last change and moves the cursor to where it was.
+ */
+extern void undo_last_change(void);
+
+/**
+ * Applies the last change that was undone again.
  */
-extern void print_line(size_t index);
+extern void redo_last_change(void);
 
 /**
  *
  */
-extern void print_current_line(void);
+extern void merge_with_next_line(void);
 
 /**
  *
  */
-extern void print_page(void);
+extern void insert_line_at_current_position(void);
+
+/******************************************************************************
+ * MARK: Render
+ *****************************************************************************/
+
+/**
+ * Actions only mark the parts of the screen they make out of date.
+ * Everything is drawn at once by render_editor after the input is handled.
+ */
+
+/**
+ * Redraws the whole screen, e.g. after a resize or a dialog.
+ */
+extern void mark_screen_damaged(void);
+
+/**
+ * Redraws all visible lines, e.g. after scrolling.
+ */
+extern void mark_page_damaged(void);
+
+/**
+ * Redraws the visible lines from first up to end (exclusive). Pass SIZE_MAX
+ * as end if the lines below moved as well.
+ */
+extern void mark_lines_damaged(size_t first, size_t end);
 
 /**
  *
  */
-extern void insert_character_at_current_position(int ch);
+extern void mark_line_damaged(size_t index);
 
 /**
  *
  */
-extern void delete_character_at_current_position(void);
+extern void mark_title_bar_damaged(void);
 
 /**
  *
  */
-extern void merge_with_next_line(void);
+extern void mark_status_bar_damaged(void);
+
+/**
+ * Shows a message in the status bar until the next input arrives.
+ */
+extern void show_status_message(const char *format, ...);
 
 /**
  *
  */
-extern void insert_line_at_current_position(void);
+extern void clear_status_message(void);
+
+/**
+ * Draws the damaged parts of the screen, places the cursor and flushes
+ * everything to the terminal in one go.
+ */
+extern void render_editor(void);
 
 /******************************************************************************
  * MARK: Actions
@@ -413,24 +1403,33 @@ extern void move_to_previous_page(void);
  *****************************************************************************/
 
 /**
- * Opens an interactive dialog window for the user to enter a line number into.
- * The return value is the line number entered by the user.
+ * Opens an interactive dialog window for the user to enter a line number into,
+ * or a byte offset prefixed with @, in decimal or 0x hexadecimal.
+ * The return value is the line number entered by the user, *column is set to
+ * the column of the byte offset or the start of the line.
  */
-extern size_t launch_goto_line_dialog(void);
+extern size_t launch_goto_line_dialog(size_t *column);
 
 /**
  * Opens an interactive dialog window for the user to enter a text into.
- * The return value is the next line number within the document where
- * the given text occurs in.
+ * The editor jumps to the first match while the text is typed. Enter keeps
+ * the match, Escape returns to where the search began. Tab switches
+ * between plain text and regex search.
  */
-extern size_t launch_find_text_dialog(void);
+extern void launch_find_text_dialog(void);
 
 /**
  * Opens an interactive dialog window for the user to enter a search text
- * and a replacement text into.
+ * and a replacement text into, and replaces all occurrences.
  */
 extern void launch_replace_text_dialog(void);
 
+/**
+ * Opens a window showing the size of the document and the statistics
+ * of the line allocator until a key is pressed.
+ */
+extern void launch_info_dialog(void);
+
 /******************************************************************************
  * MARK: Input
  *****************************************************************************/
@@ -440,6 +1439,23 @@ extern void launch_replace_text_dialog(void);
  */
 extern bool handle_input(int key);
 
+/**
+ * Waits for input and handles everything that is queued up by then.
+ * Returns false once the editor is to be closed.
+ */
+extern bool handle_pending_input(void);
+
+/**
+ * Asks the terminal to mark pasted text, which is then inserted at once
+ * instead of being handled key by key.
+ */
+extern void enable_bracketed_paste(void);
+
+/**
+ *
+ */
+extern void disable_bracketed_paste(void);
+
 /******************************************************************************
  * MARK: Utils
  *****************************************************************************/
@@ -449,7 +1465,7 @@ extern bool handle_input(int key);
 
 /* Swaps the values of two variables a and b */
 #define swap(a, b) do { \
-	int c = (a); \
+	size_t c = (a); \
 	(a) = (b); \
 	(b) = c; \
 } while (false);
@@ -459,9 +1475,19 @@ extern bool handle_input(int key);
  */
 extern size_t min(size_t a, size_t b);
 
+/**
+ * Returns the maximum size
+ */
+extern size_t max(size_t a, size_t b);
+
 /**
  * Duplicates the given string
  */
 extern char* strdup(const char *text);
 
+/**
+ * Writes all of the data, unless an error occurs
+ */
+extern bool write_fully(int fd, const void *data, size_t size);
+
 #endif /* CLIDE_H */
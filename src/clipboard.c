@@ -6,41 +6,114 @@
 struct Selection {
 	size_t start_line;
 	size_t end_line;
-	uint16_t start_column;
-	uint16_t end_column;
+	size_t start_column;
+	size_t end_column;
 	bool is_active;
 };
 
 static struct Selection selection;
 
-static struct Line* clipboard = NULL;
+/**
+ * A copied text as lines shared with the document they were copied from.
+ * Only partially selected first and last lines are copies.
+ */
+struct Clip {
+	struct Line **lines;
+	size_t num_lines;
+};
+
+/**
+ * Number of clips kept, older ones can be pasted with paste_older_clip.
+ */
+#define CLIPBOARD_RING_SIZE 16
+
+/* Newest first */
+static struct Clip clips[CLIPBOARD_RING_SIZE];
+static size_t num_clips;
+
+/* Clip pasted last and the document version right after */
+static size_t pasted_clip;
+static size_t pasted_version;
+static bool was_pasted;
+
+static void free_clip(struct Clip *clip) {
+	for (size_t i = 0; i < clip->num_lines; i++) {
+		free_line(clip->lines[i]);
+	}
+	free(clip->lines);
+	clip->lines = NULL;
+	clip->num_lines = 0;
+}
 
 void clear_clipboard(void) {
-	if (clipboard != NULL) {
-		free_line(clipboard);
-		clipboard = NULL;
+	for (size_t i = 0; i < num_clips; i++) {
+		free_clip(&clips[i]);
 	}
+	num_clips = 0;
+	was_pasted = false;
+}
+
+static struct Line* copy_line_part(struct Line *line, size_t start, size_t end) {
+	struct Line *copy = create_line();
+	for (size_t position = start, n; position < end; position += n) {
+		const char *text = segment_of(line, position, &n);
+		n = min(n, end - position);
+		append_text(&copy, text, n);
+	}
+	return copy;
+}
+
+/**
+ * Keeps the selection within the document, should an edit have left it
+ * active beyond the end of its lines.
+ */
+static void clamp_selection(void) {
+	struct Selection *s = &selection;
+	s->end_line = min(s->end_line, editor.document->num_lines - 1);
+	s->start_line = min(s->start_line, s->end_line);
+	s->end_column = min(s->end_column, length_of(*line_at(s->end_line)));
+	s->start_column = min(
+		s->start_column,
+		s->start_line == s->end_line ? s->end_column : length_of(*line_at(s->start_line))
+	);
 }
 
 void copy_current_selection(void) {
 	if (selection.is_active) {
-		clear_clipboard();
-		clipboard = create_line();
-		for (size_t line = selection.start_line; line <= selection.end_line; line++) {
-			size_t col_start = line == selection.start_line ? selection.start_column : 0;
-			size_t col_end = line == selection.end_line ? selection.end_column : (*line_at(line))->length;
-			for (size_t column = col_start; column < col_end; column++) {
-				append_character(&clipboard, char_at(line, column));
-			}
-			if (line < selection.end_line) {
-				append_character(&clipboard, '\n');
+		clamp_selection();
+		if (num_clips == CLIPBOARD_RING_SIZE) {
+			free_clip(&clips[--num_clips]);
+		}
+		memmove(clips + 1, clips, sizeof(*clips) * num_clips);
+		num_clips++;
+		was_pasted = false;
+		struct Clip *clip = &clips[0];
+		clip->num_lines = selection.end_line - selection.start_line + 1;
+		clip->lines = malloc(sizeof(*clip->lines) * clip->num_lines);
+		for (size_t i = 0; i < clip->num_lines; i++) {
+			size_t line = selection.start_line + i;
+			struct Line *source = *line_at(line);  /* Shared right away, its page may be dropped */
+			size_t start = line == selection.start_line ? selection.start_column : 0;
+			size_t end = line == selection.end_line ? selection.end_column : length_of(source);
+			if (start == 0 and end == length_of(source)) {
+				clip->lines[i] = share_line(source);
+			} else {
+				clip->lines[i] = copy_line_part(source, start, end);
 			}
 		}
 	}
 }
 
 static void delete_current_selection(void) {
-
+	if (selection.is_active) {
+		clamp_selection();
+		selection.is_active = false;
+		delete_text_range(
+			selection.start_line, selection.start_column,
+			selection.end_line, selection.end_column
+		);
+		update_current_cursor();
+	}
 }
 
 void cut_current_selection(void) {
@@ -53,29 +126,82 @@ void select_everything(void) {
 	selection.start_line = 0;
 	selection.end_line = normalize(editor.document->num_lines);
 	selection.start_column = 0;
-	selection.end_column = (*line_at(normalize(editor.document->num_lines)))->length;
-	print_page();
+	selection.end_column = length_of(*line_at(normalize(editor.document->num_lines)));
+	mark_page_damaged();
 }
 
-void paste_clipboard(void) {
-	if (clipboard != NULL) {
-		for (size_t i = 0; i < clipboard->length; i++) {
-			if (text_of(clipboard)[i] == '\n') {
-				struct Line *line = create_line();
-				insert_line(&editor.document, 1+normalize(editor.line), line);
-				append_string(&line, text_of(current_line()) + normalize(editor.column));
-				clear_line(current_line(), normalize(editor.column));
-				current_line()->length = normalize(editor.column);
-				editor.line++;
-				editor.column = 1;
-				continue;
-			}
-			insert_character_at_current_position(text_of(clipboard)[i]);
-			editor.column++;
+/**
+ * Returns the text of the clip with lines separated by newlines.
+ */
+static char* join_clip(const struct Clip *clip, size_t *length) {
+	*length = clip->num_lines - 1;
+	for (size_t i = 0; i < clip->num_lines; i++) {
+		*length += length_of(clip->lines[i]);
+	}
+	char *text = malloc(max(*length, 1));
+	char *out = text;
+	for (size_t i = 0; i < clip->num_lines; i++) {
+		size_t line_length = length_of(clip->lines[i]);
+		for (size_t position = 0, n; position < line_length; position += n) {
+			const char *segment = segment_of(clip->lines[i], position, &n);
+			memcpy(out, segment, n);
+			out += n;
 		}
-		print_page();
-		update_current_cursor();
+		if (i + 1 < clip->num_lines) {
+			*out++ = '\n';
+		}
+	}
+	return text;
+}
+
+/**
+ * Inserts the clip at the cursor. Its lines are inserted by reference,
+ * only the history keeps a copy of the text.
+ */
+static void paste_clip(size_t index) {
+	const struct Clip *clip = &clips[index];
+	size_t length;
+	char *text = join_clip(clip, &length);
+	invalidate_selection();
+	seal_history();
+	if (clip->num_lines == 1) {
+		insert_text_at_current_position(text, length);
+	} else {
+		size_t line = normalize(editor.line);
+		size_t column = normalize(editor.column);
+		record_insertion(line, column, text, length);
+		struct Line **lines = malloc(sizeof(*lines) * clip->num_lines);
+		for (size_t i = 0; i < clip->num_lines; i++) {
+			lines[i] = share_line(clip->lines[i]);
+		}
+		insert_text_lines(&editor.document, &line, &column, lines, clip->num_lines);
+		free(lines);
+		mark_lines_damaged(normalize(editor.line), SIZE_MAX);
+		editor.line = 1+line;
+		editor.column = 1+column;
+	}
+	free(text);
+	signal_modification();
+	update_current_cursor();
+	pasted_clip = index;
+	pasted_version = editor.document->version;
+	was_pasted = true;
+}
+
+void paste_clipboard(void) {
+	if (num_clips > 0) {
+		paste_clip(0);
+	}
+}
+
+void paste_older_clip(void) {
+	if (not was_pasted or pasted_version != editor.document->version) {
+		show_status_message("Paste first");
+		return;
 	}
+	undo_last_change();
+	paste_clip((pasted_clip + 1) % num_clips);
+	show_status_message("Clip %zu/%zu", pasted_clip + 1, num_clips);
 }
 
 bool active_selection(void) {
@@ -92,9 +218,7 @@ void begin_selection(void) {
 }
 
 static void repaint_selected_area(void) {
-	for (size_t line = selection.start_line; line <= selection.end_line; line++) {
-		print_line(line);
-	}
+	mark_lines_damaged(selection.start_line, 1+selection.end_line);
 }
 
 void invalidate_selection(void) {
@@ -106,6 +230,7 @@ void invalidate_selection(void) {
 
 void update_selection(void) {
 	assert (selection.is_active);
+	size_t previous_start_line = selection.start_line;
 	size_t previous_end_line = selection.end_line;
 	selection.end_line = normalize(editor.line);
 	selection.end_column = normalize(editor.column);
@@ -122,9 +247,7 @@ void update_selection(void) {
 	} else {  /* Otherwise, repaint to show selection */
 		repaint_selected_area();
 		/* Repair affected lines, if selected area has shrunk */
-		for (size_t line = 1+selection.end_line; line <= previous_end_line; line++) {
-			print_line(line);
-		}
+		mark_lines_damaged(previous_start_line, 1+previous_end_line);
 	}
 }
 
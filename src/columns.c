@@ -0,0 +1,214 @@
+#include "clide.h"
+
+/**
+ * A character of a line and the screen column it is drawn at.
+ */
+struct Checkpoint {
+	size_t position;
+	size_t column;
+};
+
+/**
+ * Screen columns of a long line at the first character at or after every
+ * COLUMN_CHECKPOINT_INTERVAL-th byte, filled in as far as they were
+ * needed. A column is found from the checkpoint before it, so tabs and
+ * UTF-8 are not decoded from the start of the line.
+ */
+struct ColumnIndex {
+	size_t line;
+	struct Checkpoint *checkpoints;
+	size_t num_checkpoints;
+	size_t num_kept;  /* those before the last edit, see keep_columns_before */
+	size_t capacity;
+	size_t last_use;  /* zero if unused */
+};
+
+#define COLUMN_CHECKPOINT_INTERVAL 256
+
+/**
+ * Number of lines whose checkpoints are kept, a few screens full.
+ */
+#define COLUMN_CACHE_SIZE 256
+
+static struct ColumnIndex column_cache[COLUMN_CACHE_SIZE];
+static size_t num_column_uses;
+
+/**
+ * Returns the screen column after the character at the given position
+ * that is drawn from the given column on. Tabs advance to the next tab
+ * stop, characters drawn on top of nothing take a cell of their own.
+ */
+static size_t step_column(struct Line *line, size_t position, size_t column) {
+	size_t n;
+	uint32_t codepoint = codepoint_at(line, position, &n);
+	if (codepoint == '\t') {
+		return column + config.tabsize - column % config.tabsize;
+	}
+	return column + max(character_width(codepoint), 1);
+}
+
+/**
+ * Walks the characters of the line that start before end, from the one at
+ * *position on, which is drawn at *column. Runs of ASCII are walked a
+ * segment at a time, only their last character may start a cluster.
+ */
+static void walk_columns(struct Line *line, size_t *position, size_t end, size_t *column) {
+	size_t length = length_of(line);
+	while (*position < end) {
+		size_t n;
+		const char *p = segment_of(line, *position, &n);
+		n = min(n, end - *position);
+		size_t ascii = count_ascii(p, n);
+		if (ascii > 0 and *position + ascii < length and (ascii < n ? (unsigned char)p[ascii] : (unsigned char)character_of(line, *position + ascii)) >= 0x80) {
+			ascii--;
+		}
+		*position += ascii;
+		for (const char *end_of_run = p + ascii; p < end_of_run; ) {
+			const char *tab = memchr(p, '\t', end_of_run - p);
+			if (tab == NULL) {
+				*column += end_of_run - p;
+				break;
+			}
+			*column += tab - p;
+			*column += config.tabsize - *column % config.tabsize;
+			p = tab + 1;
+		}
+		if (ascii < n) {
+			*column = step_column(line, *position, *column);
+			*position = next_character(line, *position);
+		}
+	}
+}
+
+static struct ColumnIndex* find_column_index(size_t index) {
+	struct ColumnIndex *oldest = &column_cache[0];
+	for (size_t i = 0; i < COLUMN_CACHE_SIZE; i++) {
+		struct ColumnIndex *entry = &column_cache[i];
+		if (entry->last_use > 0 and entry->line == index) {
+			entry->last_use = ++num_column_uses;
+			return entry;
+		}
+		if (entry->last_use < oldest->last_use) {
+			oldest = entry;
+		}
+	}
+	oldest->line = index;
+	oldest->num_checkpoints = 0;
+	oldest->num_kept = 0;
+	oldest->last_use = ++num_column_uses;
+	return oldest;
+}
+
+/**
+ * Fills in the checkpoints of the line up to the one for the given byte.
+ */
+static void extend_checkpoints(struct ColumnIndex *entry, struct Line *line, size_t position) {
+	size_t n = position / COLUMN_CHECKPOINT_INTERVAL + 1;
+	if (n <= entry->num_checkpoints) return;
+	if (n > entry->capacity) {
+		entry->capacity = max(n, 2 * entry->capacity);
+		entry->checkpoints = realloc(entry->checkpoints, sizeof(*entry->checkpoints) * entry->capacity);
+	}
+	if (entry->num_checkpoints == 0) {
+		entry->checkpoints[entry->num_checkpoints++] = (struct Checkpoint){0, 0};
+	}
+	for (size_t k = entry->num_checkpoints; k < n; k++) {
+		struct Checkpoint checkpoint = entry->checkpoints[k - 1];
+		walk_columns(line, &checkpoint.position, k * COLUMN_CHECKPOINT_INTERVAL, &checkpoint.column);
+		entry->checkpoints[k] = checkpoint;
+	}
+	entry->num_checkpoints = n;
+}
+
+size_t screen_column_of(size_t index, size_t position) {
+	struct Line *line = *line_at(index);
+	position = min(position, length_of(line));
+	struct Checkpoint checkpoint = {0, 0};
+	if (position >= COLUMN_CHECKPOINT_INTERVAL) {
+		struct ColumnIndex *entry = find_column_index(index);
+		extend_checkpoints(entry, line, position);
+		size_t k = position / COLUMN_CHECKPOINT_INTERVAL;
+		while (entry->checkpoints[k].position > position) k--;  /* Within a long character */
+		checkpoint = entry->checkpoints[k];
+	}
+	walk_columns(line, &checkpoint.position, position, &checkpoint.column);
+	return checkpoint.column;
+}
+
+size_t position_at_screen_column(size_t index, size_t column) {
+	struct Line *line = *line_at(index);
+	size_t length = length_of(line);
+	struct Checkpoint checkpoint = {0, 0};
+	if (length >= COLUMN_CHECKPOINT_INTERVAL) {
+		struct ColumnIndex *entry = find_column_index(index);
+		extend_checkpoints(entry, line, 0);
+		while (
+			entry->checkpoints[entry->num_checkpoints - 1].column <= column and
+			entry->num_checkpoints * COLUMN_CHECKPOINT_INTERVAL <= length
+		) {  /* Up to the first checkpoint past the column */
+			extend_checkpoints(entry, line, min(length, 2 * entry->num_checkpoints * COLUMN_CHECKPOINT_INTERVAL));
+		}
+		size_t first = 0, end = entry->num_checkpoints;  /* Last checkpoint at or before column */
+		while (end - first > 1) {
+			size_t middle = first + (end - first) / 2;
+			if (entry->checkpoints[middle].column <= column) {
+				first = middle;
+			} else {
+				end = middle;
+			}
+		}
+		checkpoint = entry->checkpoints[first];
+	}
+	while (checkpoint.position < length) {
+		size_t next = step_column(line, checkpoint.position, checkpoint.column);
+		if (next > column) break;
+		checkpoint.column = next;
+		checkpoint.position = next_character(line, checkpoint.position);
+	}
+	return checkpoint.position;
+}
+
+static size_t shift_line(size_t line, size_t first, size_t removed, size_t inserted) {
+	return line >= first + removed ? line - removed + inserted : line;
+}
+
+/**
+ * Lines edited in place keep their checkpoints until it is known from
+ * which position on they changed, all of them are dropped otherwise.
+ */
+void invalidate_columns(struct TextDocument *doc, size_t line, size_t removed, size_t inserted) {
+	if (doc != editor.document) return;
+	for (size_t i = 0; i < COLUMN_CACHE_SIZE; i++) {
+		struct ColumnIndex *entry = &column_cache[i];
+		if (entry->line >= line and entry->line < line + removed) {
+			entry->num_kept = entry->line < line + inserted ? entry->num_checkpoints : 0;
+			entry->num_checkpoints = 0;
+			if (entry->line >= line + inserted) {
+				entry->last_use = 0;
+			}
+		}
+		entry->line = shift_line(entry->line, line, removed, inserted);
+	}
+}
+
+void keep_columns_before(struct TextDocument *doc, size_t line, size_t position) {
+	if (doc != editor.document) return;
+	for (size_t i = 0; i < COLUMN_CACHE_SIZE; i++) {
+		struct ColumnIndex *entry = &column_cache[i];
+		if (entry->last_use > 0 and entry->line == line) {
+			entry->num_checkpoints = min(entry->num_kept, position / COLUMN_CHECKPOINT_INTERVAL + 1);
+			while (entry->num_checkpoints > 1 and entry->checkpoints[entry->num_checkpoints - 1].position + 3 >= position) {
+				entry->num_checkpoints--;  /* The edit may have joined it to the character before */
+			}
+			entry->num_kept = 0;
+		}
+	}
+}
+
+void clear_columns(void) {
+	for (size_t i = 0; i < COLUMN_CACHE_SIZE; i++) {
+		free(column_cache[i].checkpoints);
+	}
+	memset(column_cache, 0, sizeof(column_cache));
+	num_column_uses = 0;
+}
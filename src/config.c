@@ -8,15 +8,15 @@ static const char program_help[] = {
 	"\t-h       Print program help string\n"
 	"\t-v       Print program version string\n"
 	"\t-c   *   Use a color theme\n"
-	"\t-s   *   Stream file contents on demand\n"
+	"\t-s       Stream file contents on demand\n"
 	"\t-t   *   Override the tabsize (default: 8)\n"
+	"\t-u   *   Undo history kept in memory in MiB (default: 16)\n"
 	"Default keymap:\n"
 	"\tCtrl+A :  Select everything\n"
 	"\tCtrl+C :  Copy selection\n"
 	"\tCtrl+F :  Search text\n"
-	"\tCtrl+G :  Goto line number, column number\n"
+	"\tCtrl+G :  Goto line or @byte offset\n"
 	"\tCtrl+H :  Display help window\n"
-	"\tCtrl+I :  Display info window\n"
 	"\tCtrl+L :  Select current line\n"
 	"\tCtrl+O :  Open a new file\n"
 	"\tCtrl+Q :  Quit editor\n"
@@ -26,6 +26,8 @@ static const char program_help[] = {
 	"\tCtrl+X :  Cut selection\n"
 	"\tCtrl+Y :  Redo last action\n"
 	"\tCtrl+Z :  Undo last action\n"
+	"\tF2     :  Display info window\n"
+	"\tF3     :  Find next match\n"
 	"Color themes:\n"
 	"\tdark  : black background, white foreground\n"
 	"\tlight : white background, black foreground\n"
@@ -48,11 +50,12 @@ struct Config config = {
 	.input = "New Document",
 	.stream_file_contents = false,
 	.tabsize = 8,
-	.theme = "dark"
+	.theme = "dark",
+	.history_limit = 16 << 20
 };
 
 void parse_arguments(int argc, char *argv[]) {
-	static const char options[] = "c:hst:v";
+	static const char options[] = "c:hst:u:v";
 	for (;;) {
 		switch (getopt(argc, argv, options)) {
 			case -1:
@@ -79,6 +82,9 @@ void parse_arguments(int argc, char *argv[]) {
 				config.tabsize = strtol(optarg, NULL, 10);
 				set_tabsize(config.tabsize);
 				break;
+			case 'u':
+				config.history_limit = strtoul(optarg, NULL, 10) << 20;
+				break;
 		}
 	}
 }
\ No newline at end of file
@@ -19,14 +19,23 @@ static void prompt(WINDOW *form, const char *text, char *value, unsigned int siz
 	delwin(form);
 }
 
-size_t launch_goto_line_dialog(void) {
+size_t launch_goto_line_dialog(size_t *column) {
 	const int width = 4+digits(SIZE_MAX);
 	const int height = 4;
 	char value[digits(SIZE_MAX)];
 	size_t result = 1;
 	WINDOW *form = newwin(height, width, editor.height/2, editor.width/2-width/2);
 	box(form, 0, 0);
-	prompt(form, "Goto line", value, sizeof(value));
+	prompt(form, "Goto line or @byte", value, sizeof(value));
+	*column = 1;
+	if (value[0] == '@') {  /* Decimal or hexadecimal byte offset */
+		const char *number = value+1;
+		size_t offset = strtoull(number, 0, strncmp(number, "0x", 2) == 0 ? 16 : 10);
+		size_t line_offset;
+		size_t index = line_at_offset(editor.document, offset, &line_offset);
+		*column = 1+min(offset - line_offset, length_of(*line_at(index)));
+		return 1+index;
+	}
 	long line = strtol(value, 0, 10);
 	if (line > editor.document->num_lines)
 		result = editor.document->num_lines;
@@ -37,21 +46,91 @@ size_t launch_goto_line_dialog(void) {
 	return result;
 }
 
-size_t launch_find_text_dialog(void) {
+/**
+ * Searches while the text is typed. The dialog sits above the status bar,
+ * so that the match it jumps to, which is centered, stays visible.
+ */
+void launch_find_text_dialog(void) {
 	const int width = 4+digits(SIZE_MAX);
-	const int height = 6;
-	char value[128];
-	WINDOW *form = newwin(height, width, editor.height/2, editor.width/2-width/2);
+	const int height = 4;
+	char value[SEARCH_PATTERN_SIZE];
+	size_t length = 0;
+	bool is_found = true;
+	bool is_regex = false;
+	WINDOW *form = newwin(height, width, window.height-1-height, editor.width-width);
+	keypad(form, TRUE);
+	begin_search_at_current_position();
+	for (;;) {
+		render_editor();
+		werase(form);
+		box(form, 0, 0);
+		wattron(form, A_REVERSE);
+		mvwprintw(form, 1, 2, "%s%s", is_regex ? "Regex search" : "Search", is_found ? "" : " (not found)");
+		wattroff(form, A_REVERSE);
+		size_t shown = min(length, (size_t)width-4);  /* End of long texts */
+		mvwaddnstr(form, 2, 2, value+length-shown, shown);
+		struct TextDocument *doc = editor.document;
+		bool is_busy = (doc->stream != NULL and not doc->stream->is_complete) or doc->save != NULL;
+		wtimeout(form, is_indexing_matches() ? 0 : is_highlighting() ? 5 : is_busy ? 100 : -1);
+		int key = wgetch(form);
+		if (key == ERR) {  /* Index matches, streamed lines and saves between keys */
+			poll_document_editor();
+			continue;
+		} else if (key == '\n' or key == KEY_ENTER) {
+			break;
+		} else if (key == '\033') {
+			cancel_search();
+			break;
+		} else if (key == '\t') {
+			is_regex = not is_regex;
+		} else if (key == KEY_BACKSPACE or key == 127 or key == '\b') {
+			length -= length > 0;
+		} else if (key >= ' ' and key < KEY_MIN and length < sizeof(value)) {
+			value[length++] = key;
+		} else {
+			continue;
+		}
+		is_found = search_from_current_position(value, length, is_regex) or length == 0;
+		mark_status_bar_damaged();
+	}
+	delwin(form);
+}
+
+void launch_info_dialog(void) {
+	const int width = 48;
+	const int height = 10;
+	struct AllocatorStats stats;
+	get_allocator_stats(&stats);
+	WINDOW *form = newwin(height, width, editor.height/2-height/2, editor.width/2-width/2);
 	box(form, 0, 0);
-	prompt(form, "Search", value, sizeof(value));
-	return 0;
+	wattron(form, A_REVERSE);
+	mvwprintw(form, 1, 2, "Info");
+	wattroff(form, A_REVERSE);
+	mvwprintw(form, 2, 2, "Lines: %zu in %zu pages", editor.document->num_lines, editor.document->num_pages);
+	mvwprintw(form, 3, 2, "Line blocks: %zu (%zu KiB)", stats.num_blocks, stats.block_bytes / 1024);
+	mvwprintw(form, 4, 2, "Arenas: %zu (%zu KiB)", stats.num_arenas, stats.arena_bytes / 1024);
+	mvwprintw(form, 5, 2, "Allocations: %zu", stats.num_allocations);
+	mvwprintw(form, 6, 2, "Frees: %zu", stats.num_frees);
+	mvwprintw(form, 7, 2, "Lexed lines: %zu", count_lexed_lines());
+	mvwprintw(form, 8, 2, "Press any key");
+	wrefresh(form);
+	wgetch(form);
+	wclear(form);
+	wrefresh(form);
+	delwin(form);
 }
 
 void launch_replace_text_dialog(void) {
 	const int width = 4+digits(SIZE_MAX);
-	const int height = 6;
-	char value[128];
+	const int height = 4;
+	char pattern[SEARCH_PATTERN_SIZE + 1];
+	char text[128];
 	WINDOW *form = newwin(height, width, editor.height/2, editor.width/2-width/2);
 	box(form, 0, 0);
-	prompt(form, "Search", value, sizeof(value));
+	prompt(form, "Replace", pattern, sizeof(pattern) - 1);
+	if (pattern[0] == '\0') return;
+	form = newwin(height, width, editor.height/2, editor.width/2-width/2);
+	box(form, 0, 0);
+	prompt(form, "With", text, sizeof(text) - 1);
+	replace_all_matches(pattern, strlen(pattern), text, strlen(text));
 }
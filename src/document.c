@@ -1,32 +1,42 @@
 #include "clide.h"
 
-static bool document_is_exhausted(struct TextDocument *doc) {
-	return doc->num_lines >= doc->capacity;
+static struct LinePage* access_page(struct TextDocument *doc, size_t index, size_t *first_line) {
+	struct LinePage *page = find_page(doc, index, first_line);
+	if (page->lines == NULL) {
+		load_page(doc, page);
+	} else if (doc->stream != NULL and not page->is_pinned) {
+		touch_page(doc, page);
+	}
+	return page;
 }
 
-static struct TextDocument* allocate_document_memory(struct TextDocument *doc, size_t n) {
-	doc = realloc(doc, sizeof(*doc) + sizeof(*doc->lines) * n);
-	doc->capacity = n;
-	doc->lines = (void*)(doc + 1);
-	return doc;
+struct Line** get_line(struct TextDocument *doc, size_t index) {
+	assert (index < doc->num_lines);
+	size_t first_line;
+	struct LinePage *page = access_page(doc, index, &first_line);
+	return &page->lines[index - first_line];
 }
 
-static void extend_document_capacity(struct TextDocument **docptr) {
-	*docptr = allocate_document_memory(*docptr, 2 * (*docptr)->capacity);
+struct Line** edit_line(struct TextDocument *doc, size_t index) {
+	assert (index < doc->num_lines);
+	size_t first_line;
+	struct LinePage *page = access_page(doc, index, &first_line);
+	pin_page(doc, page);
+	mark_page_resized(doc, page, index);
+	unshare_line(&page->lines[index - first_line]);
+	invalidate_matches(doc, index, 1, 1);
+	invalidate_highlight(doc, index, 1, 1);
+	invalidate_columns(doc, index, 1, 1);
+	doc->version++;
+	return &page->lines[index - first_line];
 }
 
 void insert_line(struct TextDocument **docptr, size_t index, struct Line *line) {
-	assert (index <= (*docptr)->num_lines);
-	(*docptr)->num_lines++;
-	if (document_is_exhausted(*docptr)) {
-		extend_document_capacity(docptr);
-	}
-	memmove(  /* Make room for the new line */
-		(*docptr)->lines + index + 1,
-		(*docptr)->lines + index,
-		sizeof((*docptr)->lines) * ((*docptr)->num_lines - index)
-	);
-	(*docptr)->lines[index] = line;
+	insert_page_line(*docptr, index, line);
+	invalidate_matches(*docptr, index, 0, 1);
+	invalidate_highlight(*docptr, index, 0, 1);
+	invalidate_columns(*docptr, index, 0, 1);
+	(*docptr)->version++;
 }
 
 void append_line(struct TextDocument **docptr, struct Line *line) {
@@ -35,49 +45,253 @@ void append_line(struct TextDocument **docptr, struct Line *line) {
 
 void remove_line(struct TextDocument **docptr, size_t index) {
 	assert ((*docptr)->num_lines > 0);
-	assert (index < (*docptr)->num_lines);
-	memmove(  /* Overwrite the line at index */
-		(*docptr)->lines + index,
-		(*docptr)->lines + index + 1,
-		sizeof((*docptr)->lines) * ((*docptr)->num_lines - index)
-	);
-	(*docptr)->num_lines--;
+	remove_page_line(*docptr, index);
+	invalidate_matches(*docptr, index, 1, 0);
+	invalidate_highlight(*docptr, index, 1, 0);
+	invalidate_columns(*docptr, index, 1, 0);
+	(*docptr)->version++;
+}
+
+void insert_lines(struct TextDocument **docptr, size_t index, struct Line **lines, size_t n) {
+	insert_page_lines(*docptr, index, lines, n);
+	invalidate_matches(*docptr, index, 0, n);
+	invalidate_highlight(*docptr, index, 0, n);
+	invalidate_columns(*docptr, index, 0, n);
+	(*docptr)->version++;
+}
+
+void remove_lines(struct TextDocument **docptr, size_t index, size_t n) {
+	remove_page_lines(*docptr, index, n);
+	invalidate_matches(*docptr, index, n, 0);
+	invalidate_highlight(*docptr, index, n, 0);
+	invalidate_columns(*docptr, index, n, 0);
+	(*docptr)->version++;
+}
+
+/**
+ * Collects the lines of a text which is inserted into a document.
+ */
+struct TextSplice {
+	struct Line **lines;
+	size_t num_lines;
+	size_t capacity;
+};
+
+static void append_spliced_line(void *context, const char *text, size_t length) {
+	struct TextSplice *splice = context;
+	if (splice->num_lines >= splice->capacity) {
+		splice->capacity = splice->capacity ? 2 * splice->capacity : 16;
+		splice->lines = realloc(splice->lines, sizeof(*splice->lines) * splice->capacity);
+	}
+	splice->lines[splice->num_lines++] = create_line_from_text(text, length);
+}
+
+void insert_text(struct TextDocument **docptr, size_t *line, size_t *column, const char *text, size_t length) {
+	if (memchr(text, '\n', length) == NULL) {
+		insert_characters(edit_line(*docptr, *line), *column, text, length);
+		keep_columns_before(*docptr, *line, *column);
+		*column += length;
+		return;
+	}
+	struct TextSplice splice = {NULL, 0, 0};
+	split_lines(text, length, true, append_spliced_line, &splice);
+	insert_text_lines(docptr, line, column, splice.lines, splice.num_lines);
+	free(splice.lines);
+}
+
+/**
+ * The first line of the text is added to the line at the insert position,
+ * whose rest moves to the end of the last line of the text. The lines in
+ * between are inserted all at once.
+ */
+void insert_text_lines(struct TextDocument **docptr, size_t *line, size_t *column, struct Line **lines, size_t n) {
+	assert (n > 1);
+	struct Line **first = edit_line(*docptr, *line);
+	struct Line **last = &lines[n - 1];
+	size_t end_column = length_of(*last);
+	unshare_line(last);
+	append_line_text(last, *first, *column);
+	truncate_line(first, *column);
+	append_line_text(first, lines[0], 0);
+	free_line(lines[0]);
+	insert_lines(docptr, *line + 1, lines + 1, n - 1);
+	*line += n - 1;
+	*column = end_column;
+}
+
+void delete_range(
+	struct TextDocument **docptr,
+	size_t start_line, size_t start_column,
+	size_t end_line, size_t end_column
+) {
+	struct Line **first = edit_line(*docptr, start_line);
+	if (start_line == end_line) {
+		remove_characters(first, start_column, end_column - start_column);
+		keep_columns_before(*docptr, start_line, start_column);
+		return;
+	}
+	truncate_line(first, start_column);
+	append_line_text(first, *get_line(*docptr, end_line), end_column);
+	remove_lines(docptr, start_line + 1, end_line - start_line);
+}
+
+char* copy_text(
+	struct TextDocument *doc,
+	size_t start_line, size_t start_column,
+	size_t end_line, size_t end_column,
+	size_t *length
+) {
+	size_t size = offset_of_line(doc, end_line) + end_column - offset_of_line(doc, start_line) - start_column;
+	char *text = malloc(max(size, 1));  /* Sized from the page tree, it is not grown */
+	*length = 0;
+	for (size_t i = start_line; i <= end_line; i++) {
+		struct Line *line = *get_line(doc, i);
+		size_t begin = i == start_line ? start_column : 0;
+		size_t end = i == end_line ? end_column : length_of(line);
+		for (size_t position = begin, n; position < end; position += n) {
+			const char *segment = segment_of(line, position, &n);
+			n = min(n, end - position);
+			memcpy(text + *length, segment, n);
+			*length += n;
+		}
+		if (i < end_line) {
+			text[(*length)++] = '\n';
+		}
+	}
+	return text;
+}
+
+size_t split_lines(
+	const char *data, size_t size, bool is_final,
+	void (*consume)(void *context, const char *text, size_t length), void *context
+) {
+	const char *begin = data;
+	const char *end = data + size;
+	for (;;) {  /* memchr is vectorized by libc */
+		const char *newline = memchr(begin, '\n', end - begin);
+		if (newline == NULL) {
+			if (not is_final) break;
+			newline = end;
+		}
+		consume(context, begin, newline - begin);
+		if (newline == end) return size;
+		begin = newline + 1;
+	}
+	return begin - data;
+}
+
+/**
+ * Files which cannot be memory-mapped (pipes, procfs, ...) are read in
+ * blocks of this size instead.
+ */
+static const size_t read_block_size = 1 << 20;
+
+/**
+ * Fills the loading page with lines and hands it to the page tree
+ * once LINES_PER_PAGE is reached.
+ */
+static void append_loaded_line(struct TextDocument *doc, struct Line *line) {
+	struct LinePage *page = doc->loading_page;
+	if (page->num_lines >= LINES_PER_PAGE) {
+		append_page(doc, page);
+		page = doc->loading_page = create_page(LINES_PER_PAGE);
+	}
+	page->lines[page->num_lines++] = line;
+	page->num_bytes += length_of(line) + 1;
+}
+
+static void append_copied_line(void *context, const char *text, size_t length) {
+	append_loaded_line(context, create_line_from_text(text, length));
+}
+
+static void append_line_view(void *context, const char *text, size_t length) {
+	append_loaded_line(context, create_line_view(text, length));
+}
+
+/**
+ * Lines of mapped documents are views onto the mapping
+ * until they are modified. Nothing is copied upfront.
+ */
+static bool map_document_contents(struct TextDocument *doc, int fd, size_t size) {
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) return false;
+	doc->mapping = data;
+	doc->mapping_size = size;
+	split_lines(data, size, true, append_line_view, doc);
+	return true;
+}
+
+static void read_document_contents(struct TextDocument *doc, int fd) {
+	size_t capacity = read_block_size;
+	size_t size = 0;
+	char *buffer = malloc(capacity);
+	for (;;) {
+		if (capacity - size < read_block_size) {
+			capacity *= 2;
+			buffer = realloc(buffer, capacity);
+		}
+		ssize_t n = read(fd, buffer + size, read_block_size);
+		if (n <= 0) break;
+		size += n;
+		size_t consumed = split_lines(buffer, size, false, append_copied_line, doc);
+		memmove(buffer, buffer + consumed, size - consumed);  /* Keep partial line */
+		size -= consumed;
+	}
+	split_lines(buffer, size, true, append_copied_line, doc);
+	free(buffer);
 }
 
 struct TextDocument* open_document(const char *path) {
-	static const size_t default_capacity = 128; /* num lines */
-	struct TextDocument *doc = allocate_document_memory(NULL, default_capacity);
-	FILE *fp = fopen(path, "rt");
+	struct TextDocument *doc = calloc(1, sizeof(*doc));
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	bool is_regular = fd >= 0 and fstat(fd, &info) == 0 and S_ISREG(info.st_mode);
 	doc->path = strdup(path);
-	doc->num_lines = 0;
-	if (fp != NULL) {
-		while (not feof(fp)) {
-			append_line(&doc, read_line_from_file(fp));
+	if (is_regular and config.stream_file_contents) {
+		open_document_stream(doc, fd);
+		return doc;
+	}
+	doc->loading_page = create_page(LINES_PER_PAGE);
+	if (fd >= 0) {
+		if (not is_regular or info.st_size == 0
+				or not map_document_contents(doc, fd, info.st_size)) {
+			read_document_contents(doc, fd);
 		}
-		fclose(fp);
+		close(fd);
 	} else {
-		append_line(&doc, create_line());
+		append_loaded_line(doc, create_line());
 	}
+	append_page(doc, doc->loading_page);
+	doc->loading_page = NULL;
 	return doc;
 }
 
+/**
+ * Writing to a private mapping copies the pages written to, which then no
+ * longer follow the file. The writes store the bytes that are there.
+ */
+bool detach_document_mapping(struct TextDocument *doc) {
+	if (doc->mapping == NULL) return true;
+	volatile char *data = (char*)doc->mapping;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	if (mprotect((void*)doc->mapping, doc->mapping_size, PROT_READ | PROT_WRITE) != 0) return false;
+	for (size_t i = 0; i < doc->mapping_size; i += page_size) {
+		data[i] = data[i];
+	}
+	mprotect((void*)doc->mapping, doc->mapping_size, PROT_READ);
+	return true;
+}
+
 void close_document(struct TextDocument *doc) {
-	size_t index;
-	for (index = 0; index < doc->num_lines; index++) {
-		free_line(doc->lines[index]);
+	struct SaveReport report;
+	finish_document_save(doc, &report);
+	if (doc->stream != NULL) {
+		close_document_stream(doc);
+	}
+	free_page_tree(doc);
+	if (doc->mapping != NULL) {
+		munmap((void*)doc->mapping, doc->mapping_size);
 	}
 	free(doc->path);
 	free(doc);
 }
-
-void save_document(struct TextDocument *doc) {
-	FILE *fp = fopen(doc->path, "wt");
-	if (fp != NULL) {
-		size_t i;
-		for (i = 0; i < doc->num_lines; i++) {
-			fputs(text_of(doc->lines[i]), fp);
-			fputc('\n', fp);
-		}
-		fclose(fp);
-	}
-}
\ No newline at end of file
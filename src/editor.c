@@ -4,7 +4,8 @@ struct DocumentEditor editor;
 
 void signal_modification(void) {
 	editor.was_modified = true;
-	print_title_bar();
+	mark_title_bar_damaged();
+	mark_status_bar_damaged();
 }
 
 void open_document_editor(void) {
@@ -13,23 +14,88 @@ void open_document_editor(void) {
 	editor.column = 1;
 	editor.line_offset = 0;
 	editor.column_offset = 0;
-	update_cursor(editor.line-1, editor.column-1);
-	print_title_bar();
-	print_page();
+	begin_highlight();
+	mark_screen_damaged();
+	update_input_timeout();
+}
+
+void update_input_timeout(void) {
+	bool is_indexing = editor.document->stream != NULL and not editor.document->stream->is_complete;
+	if (is_indexing_matches()) {
+		timeout(0);  /* Index matches between keys */
+	} else if (is_highlighting()) {
+		timeout(5);  /* Pick up lexed lines soon */
+	} else if (is_indexing or editor.document->save != NULL) {
+		timeout(100);  /* Poll for background work */
+	} else {
+		timeout(-1);
+	}
+}
+
+static void report_save(struct SaveReport *report) {
+	if (report->error != 0) {
+		show_status_message("Could not save: %s", strerror(report->error));
+		return;
+	}
+	if (not report->has_later_edits) {
+		editor.was_modified = false;
+		mark_title_bar_damaged();
+	}
+	show_status_message(
+		"Saved %lld bytes in %.0f ms",
+		(long long)report->size, report->seconds * 1000
+	);
+}
+
+void poll_document_editor(void) {
+	struct SaveReport report;
+	update_document_stream(editor.document);
+	update_match_index();
+	if (update_document_save(editor.document, &report)) {
+		report_save(&report);
+	}
+	update_input_timeout();
+	mark_status_bar_damaged();
+}
+
+/**
+ * The document is saved in the background. A save that is still running
+ * is waited for before the next one begins.
+ */
+void save_document_editor(void) {
+	struct SaveReport report;
+	if (editor.document->save != NULL) {
+		finish_document_save(editor.document, &report);
+		report_save(&report);
+	}
+	begin_document_save(editor.document);
+	update_input_timeout();
+	mark_status_bar_damaged();
 }
 
 void close_document_editor(void) {
+	clear_clipboard();
+	clear_history();
+	end_search();
+	end_highlight();
+	clear_columns();
 	close_document(editor.document);
 }
 
 struct Line** line_at(size_t index) {
 	assert (index >= 0);
 	assert (index < editor.document->num_lines);
-	return &editor.document->lines[index];
+	return get_line(editor.document, index);
+}
+
+struct Line** edit_line_at(size_t index) {
+	assert (index >= 0);
+	assert (index < editor.document->num_lines);
+	return edit_line(editor.document, index);
 }
 
 int char_at(size_t line_number, size_t index) {
-	return text_of(*line_at(line_number))[index];
+	return character_of(*line_at(line_number), index);
 }
 
 struct Line* current_line(void) {
@@ -38,90 +104,186 @@ struct Line* current_line(void) {
 
 int current_character(int n) {
 	assert (normalize(editor.column)+n >= 0);
-	assert (normalize(editor.column)+n < current_line()->length);
-	return text_of(current_line())[normalize(editor.column)+n];
-}
-
-static bool line_is_visible(size_t line_number) {
-	return (
-		line_number >= editor.line_offset and
-		line_number < editor.line_offset + editor.height
-	);
-}
-
-void print_line(size_t index) {
-	assert (line_is_visible(index));
-	struct Line *line = *line_at(index);
-	push_cursor();
-	update_cursor(index, 0);
-	int curx = editor.x;
-	clrtoeol();
-	if (editor.column_offset < line->length) /* nobrackets */
-	for (size_t i = 0; i < line->length - editor.column_offset; i++) {
-		if (curx >= editor.width) break;
-		if (active_selection()) highlight_selection(index, i);
-		addch(text_of(line)[editor.column_offset + i]);
-		curx++;
-	}
-	pop_cursor();
-}
-
-void print_current_line(void) {
-	print_line(normalize(editor.line));
-}
-
-void print_page(void) {
-	size_t end = min(editor.document->num_lines, editor.height);
-	int y = editor.y;
-	for (size_t i = 0; i < end; i++) {
-		if (editor.line_offset + i < editor.document->num_lines) {
-			print_line(editor.line_offset + i);
-		} else {
-			move(y, 0);
-			clrtoeol();
-		}
-		y++;
-	}
-	refresh();
+	assert (normalize(editor.column)+n < length_of(current_line()));
+	return character_of(current_line(), normalize(editor.column)+n);
 }
 
 void insert_character_at_current_position(int ch) {
+	char text = ch;
+	record_insertion(normalize(editor.line), normalize(editor.column), &text, 1);
 	insert_character(
-		line_at(normalize(editor.line)),
+		edit_line_at(normalize(editor.line)),
 		normalize(editor.column),
 		ch
 	);
+	keep_columns_before(editor.document, normalize(editor.line), normalize(editor.column));
+	mark_line_damaged(normalize(editor.line));
 	signal_modification();
 }
 
+void insert_text_at_current_position(const char *text, size_t length) {
+	size_t line = normalize(editor.line);
+	size_t column = normalize(editor.column);
+	record_insertion(line, column, text, length);
+	insert_text(&editor.document, &line, &column, text, length);
+	mark_lines_damaged(normalize(editor.line), line == normalize(editor.line) ? line + 1 : SIZE_MAX);
+	editor.line = 1+line;
+	editor.column = 1+column;
+}
+
 void delete_character_at_current_position(void) {
-	if (normalize(editor.column) < current_line()->length) {
-		remove_character(
-			line_at(normalize(editor.line)),
-			normalize(editor.column)
+	if (normalize(editor.column) < length_of(current_line())) {
+		size_t end = next_character(current_line(), normalize(editor.column));
+		record_deletion(
+			normalize(editor.line), normalize(editor.column),
+			normalize(editor.line), end
 		);
+		remove_characters(
+			edit_line_at(normalize(editor.line)),
+			normalize(editor.column),
+			end - normalize(editor.column)
+		);
+		keep_columns_before(editor.document, normalize(editor.line), normalize(editor.column));
 	}
+	mark_line_damaged(normalize(editor.line));
+	signal_modification();
+}
+
+void delete_text_range(size_t line, size_t column, size_t end_line, size_t end_column) {
+	seal_history();
+	record_deletion(line, column, end_line, end_column);
+	seal_history();
+	delete_range(&editor.document, line, column, end_line, end_column);
+	mark_lines_damaged(line, line == end_line ? line + 1 : SIZE_MAX);
+	editor.line = 1+line;
+	editor.column = 1+column;
 	signal_modification();
 }
 
 void merge_with_next_line(void) {
 	if (normalize(editor.line) < editor.document->num_lines) {
-		struct Line *next_line = *line_at(1+normalize(editor.line));
-		append_string(
-			line_at(normalize(editor.line)),
-			text_of(next_line)
+		record_deletion(
+			normalize(editor.line), length_of(current_line()),
+			1+normalize(editor.line), 0
 		);
+		struct Line *next_line = *line_at(1+normalize(editor.line));
+		append_line_text(edit_line_at(normalize(editor.line)), next_line, 0);
 		remove_line(&editor.document, 1+normalize(editor.line));
 		free_line(next_line);
+		mark_lines_damaged(normalize(editor.line), SIZE_MAX);
 		signal_modification();
 	}
 }
 
 void insert_line_at_current_position(void) {
 	size_t lineno = 1+normalize(editor.line);
+	record_insertion(normalize(editor.line), normalize(editor.column), "\n", 1);
 	insert_line(&editor.document, lineno, create_line());
-	append_string(line_at(lineno), text_of(current_line()) + normalize(editor.column));
-	clear_line(current_line(), normalize(editor.column));
-	current_line()->length = normalize(editor.column);
+	append_line_text(edit_line_at(lineno), current_line(), normalize(editor.column));
+	truncate_line(edit_line_at(normalize(editor.line)), normalize(editor.column));
+	mark_lines_damaged(normalize(editor.line), SIZE_MAX);
 	signal_modification();
 }
+
+static void move_to_change(size_t line, size_t column) {
+	editor.line = 1+line;
+	editor.column = 1+column;
+	mark_page_damaged();
+	signal_modification();
+	update_current_cursor();
+}
+
+/**
+ * The matches are collected aside from the search, which keeps its
+ * pattern and position and follows the replacements like any edit.
+ */
+void replace_all_matches(const char *pattern, size_t length, const char *text, size_t text_length) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct DocumentStream *stream = editor.document->stream;
+	if (stream != NULL and not stream->is_complete) {  /* Replace in the lines not indexed yet too */
+		finish_document_stream(editor.document);
+		update_input_timeout();
+	}
+	size_t n;
+	struct IndexedMatch *matches = collect_matches(pattern, length, false, &n);
+	struct Replacement *replacements = malloc(sizeof(*replacements) * max(n, 1));
+	for (size_t i = 0; i < n; i++) {
+		replacements[i].line = matches[i].line;
+		replacements[i].column = matches[i].column;
+		replacements[i].length = matches[i].length;
+		replacements[i].text = text;
+		replacements[i].text_length = text_length;
+	}
+	free(matches);
+	if (n > 0) {
+		record_replacements(replacements, n);
+		replace_text(editor.document, replacements, n);
+		move_to_change(replacements[0].line, replacements[0].column);
+	}
+	free(replacements);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	show_status_message("Replaced %zu matches in %.0f ms", n, seconds * 1000);
+}
+
+void undo_last_change(void) {
+	size_t line, column;
+	if (undo_change(&line, &column)) {
+		move_to_change(line, column);
+	}
+}
+
+void redo_last_change(void) {
+	size_t line, column;
+	if (redo_change(&line, &column)) {
+		move_to_change(line, column);
+	}
+}
+
+/* Position the current search began at */
+static size_t search_line, search_column;
+
+/**
+ * Moves to a position and centers it vertically if it is off the screen.
+ * Matches are highlighted on the whole page, so it is repainted.
+ */
+static void move_to_match(size_t line, size_t column) {
+	if (line < editor.line_offset or line >= editor.line_offset + editor.height) {
+		editor.line_offset = line - min(line, editor.height/2);
+	}
+	editor.line = 1+line;
+	editor.column = 1+column;
+	mark_page_damaged();
+	update_current_cursor();
+}
+
+void begin_search_at_current_position(void) {
+	search_line = normalize(editor.line);
+	search_column = normalize(editor.column);
+	begin_search(search_line, search_column);
+}
+
+bool search_from_current_position(const char *pattern, size_t length, bool is_regex) {
+	const struct SearchMatch *match = update_search(pattern, length, is_regex);
+	if (match != NULL and match->is_found) {
+		move_to_match(match->line, match->column);
+		return true;
+	}
+	move_to_match(search_line, search_column);
+	return false;
+}
+
+void cancel_search(void) {
+	end_search();
+	move_to_match(search_line, search_column);
+}
+
+bool move_to_next_match(void) {
+	struct SearchMatch match;
+	if (find_next_match(normalize(editor.line), normalize(editor.column), &match)) {
+		move_to_match(match.line, match.column);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,668 @@
+#include "clide.h"
+
+/**
+ * States of the lexer between lines. A line is lexed again if its start
+ * state or its text changed. Its old end state is kept until then: if the
+ * new one is the same, the lines after it need not be lexed again.
+ */
+enum LexerState {
+	STATE_CODE,
+	STATE_COMMENT,  /* within a block comment */
+	STATE_STRING,  /* within a string continued by a backslash */
+	STATE_UNKNOWN = 0x7F,  /* of inserted lines */
+	STATE_DIRTY = 0x80  /* flag of lines to lex again */
+};
+
+/**
+ * Token runs of a line that was drawn recently. They are current as long
+ * as the line and its start state do not change, and are still drawn
+ * after that until the worker has lexed the line again.
+ */
+struct CachedRuns {
+	size_t line;
+	uint8_t start_state;
+	bool is_current;  /* false once the line was edited */
+	struct TokenRun *runs;
+	size_t num_runs;
+	size_t capacity;
+	size_t last_use;  /* zero if unused */
+};
+
+/**
+ * Number of lines whose runs are kept, a few screens full.
+ */
+#define RUN_CACHE_SIZE 256
+
+/**
+ * Consecutive lines handed to the worker, with their text at the given
+ * version of the document. The text of views is read from the mapping,
+ * that of other lines is copied, since the document is not thread-safe.
+ * The worker lexes the lines from the start state on and collects the
+ * runs of those from runs_first to runs_end. From lex_end on, it stops at
+ * the first line whose end state came out as before, unless the next one
+ * is dirty: the lines after it are up to date.
+ */
+struct HighlightJob {
+	size_t version;
+	size_t first_line;
+	size_t num_lines;
+	uint8_t start_state;
+	const char **texts;
+	size_t *lengths;
+	uint8_t *states;  /* old end states, replaced by the new ones */
+	char *copy;
+	size_t runs_first, runs_end;
+	size_t lex_end;
+	struct CachedRuns *runs;  /* of the lines from runs_first on */
+	size_t num_lexed;
+	bool is_converged;  /* if the lines after the lexed ones are up to date */
+};
+
+/**
+ * The thread lexing one job at a time. The main thread hands it a job
+ * when it has none and picks up the result when rendering or polling, so
+ * it never waits for the lexer.
+ */
+struct HighlightWorker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t has_job;
+	struct HighlightJob *job;  /* (locked) waiting to be lexed */
+	struct HighlightJob *result;  /* (locked) lexed, not picked up yet */
+	bool is_stopping;  /* (locked) */
+};
+
+static struct HighlightWorker worker;
+
+/**
+ * Lines lexed per job at most, and text copied for it. Results are only
+ * picked up between keys, so jobs must not be too small either.
+ */
+static const size_t job_lines = 1 << 16;
+static const size_t job_copy_size = 1 << 22;
+
+/**
+ * The end states of the lines of the document of the editor, from the
+ * first line on up to the last one that was lexed. States before
+ * first_dirty are up to date. From there on, lines are lexed again up to
+ * the first one whose end state did not change, and then from the next
+ * dirty line on, up to last_dirty. Lexing is done by the worker: the
+ * lines on the screen first, then the rest of the document.
+ */
+struct Highlight {
+	bool is_enabled;
+	uint8_t *states;
+	size_t num_states;
+	size_t capacity;
+	size_t first_dirty, last_dirty;  /* of lines to lex, last_dirty is past the end */
+	struct CachedRuns cache[RUN_CACHE_SIZE];
+	size_t num_uses;
+	struct HighlightJob *job;  /* handed to the worker */
+	bool is_busy;  /* while a job is lexed or lines are left to lex */
+	size_t num_lexed;
+};
+
+static struct Highlight highlight;
+
+static attr_t token_attributes[NUM_TOKEN_KINDS] = {
+	[TOKEN_KEYWORD] = A_BOLD,
+	[TOKEN_TYPE] = A_BOLD,
+	[TOKEN_DIRECTIVE] = A_BOLD
+};
+
+static const char *const keywords[] = {
+	"break", "case", "catch", "class", "const", "constexpr", "continue",
+	"default", "delete", "do", "else", "enum", "extern", "false", "for",
+	"goto", "if", "inline", "namespace", "new", "nullptr", "operator",
+	"private", "protected", "public", "register", "restrict", "return",
+	"sizeof", "static", "struct", "switch", "template", "this", "throw",
+	"true", "try", "typedef", "typename", "union", "using", "virtual",
+	"volatile", "while"
+};
+
+static const char *const types[] = {
+	"auto", "bool", "char", "double", "float", "int", "long", "short",
+	"signed", "size_t", "unsigned", "void"
+};
+
+static const char *const source_extensions[] = {
+	".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx"
+};
+
+void init_token_colors(short background) {
+	static const short colors[NUM_TOKEN_KINDS] = {
+		[TOKEN_KEYWORD] = COLOR_YELLOW,
+		[TOKEN_TYPE] = COLOR_GREEN,
+		[TOKEN_STRING] = COLOR_RED,
+		[TOKEN_NUMBER] = COLOR_MAGENTA,
+		[TOKEN_COMMENT] = COLOR_CYAN,
+		[TOKEN_DIRECTIVE] = COLOR_BLUE
+	};
+	token_attributes[TOKEN_TEXT] = COLOR_PAIR(TOKEN_COLOR_PAIR);
+	for (int kind = TOKEN_TEXT + 1; kind < NUM_TOKEN_KINDS; kind++) {
+		init_pair(TOKEN_COLOR_PAIR + kind, colors[kind], background);
+		token_attributes[kind] |= COLOR_PAIR(TOKEN_COLOR_PAIR + kind);
+	}
+}
+
+attr_t token_attribute(enum TokenKind kind) {
+	return token_attributes[kind];
+}
+
+static int compare_words(const void *word, const void *entry) {
+	return strcmp(word, *(const char *const*)entry);
+}
+
+static enum TokenKind kind_of_word(const char *text, size_t length) {
+	char word[16];
+	if (length >= sizeof(word)) return TOKEN_TEXT;
+	memcpy(word, text, length);
+	word[length] = '\0';
+	if (bsearch(word, keywords, lengthof(keywords), sizeof(*keywords), compare_words) != NULL) {
+		return TOKEN_KEYWORD;
+	}
+	if (bsearch(word, types, lengthof(types), sizeof(*types), compare_words) != NULL) {
+		return TOKEN_TYPE;
+	}
+	return TOKEN_TEXT;
+}
+
+static bool is_word_character(char ch) {
+	return isalnum((unsigned char)ch) or ch == '_';
+}
+
+/**
+ * Collects the runs of a line. Without a cache entry, only the end state
+ * is of interest.
+ */
+static void add_run(struct CachedRuns *entry, size_t column, enum TokenKind kind) {
+	if (entry == NULL) return;
+	if (entry->num_runs > 0) {
+		struct TokenRun *last = &entry->runs[entry->num_runs - 1];
+		if (last->kind == kind) return;
+		if (last->column == column) {
+			last->kind = kind;
+			return;
+		}
+	}
+	if (entry->num_runs >= entry->capacity) {
+		entry->capacity = entry->capacity ? 2 * entry->capacity : 16;
+		entry->runs = realloc(entry->runs, sizeof(*entry->runs) * entry->capacity);
+	}
+	entry->runs[entry->num_runs].column = column;
+	entry->runs[entry->num_runs].kind = kind;
+	entry->num_runs++;
+}
+
+/**
+ * Moves *i past the end of a string or character literal and returns
+ * true, or to the end of the line if the literal is not closed on it.
+ */
+static bool skip_literal(const char *text, size_t length, size_t *i, char quote) {
+	for (; *i < length; ++*i) {
+		if (text[*i] == '\\') {
+			++*i;
+		} else if (text[*i] == quote) {
+			++*i;
+			return true;
+		}
+	}
+	*i = length;
+	return false;
+}
+
+/**
+ * Moves *i past the end of a block comment and returns true, or to the
+ * end of the line if the comment is not closed on it.
+ */
+static bool skip_comment(const char *text, size_t length, size_t *i) {
+	for (const char *p = text + *i; p + 1 < text + length; p++) {
+		p = memchr(p, '*', text + length - 1 - p);
+		if (p == NULL) break;
+		if (p[1] == '/') {
+			*i = p - text + 2;
+			return true;
+		}
+	}
+	*i = length;
+	return false;
+}
+
+/**
+ * Lexes a line of C or C++ and returns the state at its end. Strings
+ * continue on the next line after a backslash, block comments until they
+ * are closed.
+ */
+static uint8_t lex_line(const char *text, size_t length, uint8_t state, struct CachedRuns *entry) {
+	size_t i = 0;
+	bool is_continued = length > 0 and text[length - 1] == '\\';
+	if (state == STATE_COMMENT) {
+		add_run(entry, 0, TOKEN_COMMENT);
+		if (not skip_comment(text, length, &i)) return STATE_COMMENT;
+	} else if (state == STATE_STRING) {
+		add_run(entry, 0, TOKEN_STRING);
+		if (not skip_literal(text, length, &i, '"')) return is_continued ? STATE_STRING : STATE_CODE;
+	}
+	if (i < length) {
+		add_run(entry, i, TOKEN_TEXT);
+	}
+	bool is_line_start = state == STATE_CODE;
+	while (i < length) {
+		char ch = text[i];
+		size_t start = i;
+		if (ch == ' ' or ch == '\t') {
+			i++;
+			continue;
+		} else if (ch == '/' and i + 1 < length and text[i + 1] == '/') {
+			add_run(entry, i, TOKEN_COMMENT);
+			return STATE_CODE;
+		} else if (ch == '/' and i + 1 < length and text[i + 1] == '*') {
+			add_run(entry, i, TOKEN_COMMENT);
+			i += 2;
+			if (not skip_comment(text, length, &i)) return STATE_COMMENT;
+		} else if (ch == '"' or ch == '\'') {
+			add_run(entry, i, TOKEN_STRING);
+			i++;
+			if (not skip_literal(text, length, &i, ch)) return ch == '"' and is_continued ? STATE_STRING : STATE_CODE;
+		} else if (ch == '#' and is_line_start) {
+			add_run(entry, i, TOKEN_DIRECTIVE);
+			for (i++; i < length and (text[i] == ' ' or text[i] == '\t'); i++);
+			while (i < length and is_word_character(text[i])) i++;
+		} else if (isdigit((unsigned char)ch) or (ch == '.' and i + 1 < length and isdigit((unsigned char)text[i + 1]))) {
+			add_run(entry, i, TOKEN_NUMBER);
+			while (i < length and (is_word_character(text[i]) or text[i] == '.')) i++;
+		} else if (is_word_character(ch)) {
+			while (i < length and is_word_character(text[i])) i++;
+			if (entry != NULL) {
+				add_run(entry, start, kind_of_word(text + start, i - start));
+			}
+		} else {
+			i++;
+		}
+		is_line_start = false;
+		if (i < length) {
+			add_run(entry, i, TOKEN_TEXT);
+		}
+	}
+	return STATE_CODE;
+}
+
+static uint8_t start_state_of(size_t index) {
+	return index == 0 ? STATE_CODE : highlight.states[index - 1] & ~STATE_DIRTY;
+}
+
+static size_t find_next_dirty(size_t from) {
+	for (; from < highlight.last_dirty; from++) {
+		if (highlight.states[from] & STATE_DIRTY) return from;
+	}
+	return highlight.num_states;
+}
+
+static void lex_job(struct HighlightJob *job) {
+	uint8_t state = job->start_state;
+	size_t k = 0;
+	while (k < job->num_lines) {
+		size_t line = job->first_line + k;
+		struct CachedRuns *entry = NULL;
+		if (line >= job->runs_first and line < job->runs_end) {
+			entry = &job->runs[line - job->runs_first];
+			entry->start_state = state;
+			add_run(entry, 0, TOKEN_TEXT);
+		}
+		uint8_t old = job->states[k];
+		state = job->states[k] = lex_line(job->texts[k], job->lengths[k], state, entry);
+		k++;
+		if (
+			state == (old & ~STATE_DIRTY) and line + 1 >= job->lex_end and
+			(k == job->num_lines or not (job->states[k] & STATE_DIRTY))
+		) {
+			job->is_converged = true;
+			break;
+		}
+	}
+	job->num_lexed = k;
+}
+
+static void* run_highlight_worker(void *argument) {
+	pthread_mutex_lock(&worker.lock);
+	for (;;) {
+		while (worker.job == NULL and not worker.is_stopping) {
+			pthread_cond_wait(&worker.has_job, &worker.lock);
+		}
+		if (worker.is_stopping) break;
+		struct HighlightJob *job = worker.job;
+		worker.job = NULL;
+		pthread_mutex_unlock(&worker.lock);
+		lex_job(job);
+		pthread_mutex_lock(&worker.lock);
+		worker.result = job;
+	}
+	pthread_mutex_unlock(&worker.lock);
+	return NULL;
+}
+
+static void start_highlight_worker(void) {
+	pthread_mutex_init(&worker.lock, NULL);
+	pthread_cond_init(&worker.has_job, NULL);
+	pthread_create(&worker.thread, NULL, run_highlight_worker, NULL);
+}
+
+static void stop_highlight_worker(void) {
+	pthread_mutex_lock(&worker.lock);
+	worker.is_stopping = true;
+	pthread_cond_signal(&worker.has_job);
+	pthread_mutex_unlock(&worker.lock);
+	pthread_join(worker.thread, NULL);
+	pthread_cond_destroy(&worker.has_job);
+	pthread_mutex_destroy(&worker.lock);
+	memset(&worker, 0, sizeof(worker));
+}
+
+static void free_job(struct HighlightJob *job) {
+	if (job == NULL) return;
+	for (size_t i = job->runs_first; i < job->runs_end; i++) {
+		free(job->runs[i - job->runs_first].runs);
+	}
+	free(job->runs);
+	free(job->copy);
+	free(job->states);
+	free(job->lengths);
+	free(job->texts);
+	free(job);
+}
+
+/**
+ * Takes the text of a line for a job, or returns false if it does not fit
+ * into the copied text. Lines copied first make room for themselves.
+ */
+static bool add_job_line(struct HighlightJob *job, struct Line *line, size_t *copied) {
+	size_t length = length_of(line);
+	const char *text;
+	if (line->capacity == 0) {  /* Views stay valid while the document is open */
+		text = ((struct LineView*)line)->text;
+	} else {
+		size_t capacity = max(job_copy_size, job->num_lines == 0 ? length : 0);  /* Long first lines make room */
+		if (*copied + length > capacity) return false;
+		if (job->copy == NULL) {
+			job->copy = malloc(capacity);
+		}
+		char *out = job->copy + *copied;
+		for (size_t position = 0, n; position < length; position += n) {
+			const char *segment = segment_of(line, position, &n);
+			memcpy(out + position, segment, min(n, length - position));
+		}
+		text = out;
+		*copied += length;
+	}
+	size_t index = job->first_line + job->num_lines;
+	job->texts[job->num_lines] = text;
+	job->lengths[job->num_lines] = length;
+	job->states[job->num_lines] = index < highlight.num_states ? highlight.states[index] : STATE_UNKNOWN;
+	job->num_lines++;
+	return true;
+}
+
+/**
+ * Hands up to n lines from the given one on to the worker, collecting the
+ * runs of those within [runs_first, runs_end). The first n are lexed even
+ * if their states are up to date, if is_fixed.
+ */
+static void submit_job(size_t first, size_t n, size_t runs_first, size_t runs_end, bool is_fixed) {
+	struct TextDocument *doc = editor.document;
+	n = min(n, doc->num_lines - first);
+	struct HighlightJob *job = calloc(1, sizeof(*job));
+	job->version = doc->version;
+	job->first_line = first;
+	job->start_state = start_state_of(first);
+	job->texts = malloc(sizeof(*job->texts) * n);
+	job->lengths = malloc(sizeof(*job->lengths) * n);
+	job->states = malloc(n);
+	size_t copied = 0, first_line;
+	struct LinePage *page = find_page(doc, first, &first_line);
+	for (; page != NULL and job->num_lines < n; page = page->next) {
+		if (page->lines == NULL) {
+			get_line(doc, first_line);  /* Pages the lines in */
+		}
+		size_t i = first + job->num_lines - first_line;
+		while (i < page->num_lines and job->num_lines < n and add_job_line(job, page->lines[i], &copied)) i++;
+		if (i < page->num_lines) break;
+		first_line += page->num_lines;
+	}
+	job->runs_first = max(runs_first, first);
+	job->runs_end = min(runs_end, first + job->num_lines);
+	if (job->runs_first >= job->runs_end) {
+		job->runs_first = job->runs_end = 0;
+	}
+	job->runs = calloc(job->runs_end - job->runs_first, sizeof(*job->runs));
+	job->lex_end = is_fixed ? first + job->num_lines : 0;
+	highlight.job = job;
+	pthread_mutex_lock(&worker.lock);
+	worker.job = job;
+	pthread_cond_signal(&worker.has_job);
+	pthread_mutex_unlock(&worker.lock);
+}
+
+static struct CachedRuns* find_cached_runs(size_t index) {
+	for (size_t i = 0; i < RUN_CACHE_SIZE; i++) {
+		struct CachedRuns *entry = &highlight.cache[i];
+		if (entry->last_use > 0 and entry->line == index) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the cache entry of a line, reusing the least recently used one
+ * if the line has none.
+ */
+static struct CachedRuns* claim_cached_runs(size_t index) {
+	struct CachedRuns *oldest = &highlight.cache[0];
+	for (size_t i = 0; i < RUN_CACHE_SIZE; i++) {
+		struct CachedRuns *entry = &highlight.cache[i];
+		if (entry->last_use > 0 and entry->line == index) {
+			return entry;
+		}
+		if (entry->last_use < oldest->last_use) {
+			oldest = entry;
+		}
+	}
+	oldest->line = index;
+	return oldest;
+}
+
+static bool has_current_runs(size_t index) {
+	struct CachedRuns *entry = find_cached_runs(index);
+	return (
+		entry != NULL and entry->is_current and index <= highlight.first_dirty and
+		entry->start_state == start_state_of(index)
+	);
+}
+
+/**
+ * Takes over the end states and runs of a job. Lines after one whose end
+ * state changed are damaged, they are drawn in a different state, and so
+ * are lines whose runs arrived.
+ */
+static void apply_job(struct HighlightJob *job) {
+	for (size_t k = 0; k < job->num_lexed; k++) {
+		size_t i = job->first_line + k;
+		if (i == highlight.num_states) {
+			if (highlight.num_states >= highlight.capacity) {
+				highlight.capacity = max(2 * highlight.capacity, 1024);
+				highlight.states = realloc(highlight.states, highlight.capacity);
+			}
+			highlight.num_states++;
+		} else if ((highlight.states[i] & ~STATE_DIRTY) != job->states[k]) {
+			mark_line_damaged(i + 1);
+		}
+		highlight.states[i] = job->states[k];
+	}
+	size_t end = job->first_line + job->num_lexed;
+	if (end > highlight.first_dirty) {
+		highlight.first_dirty = job->is_converged ? find_next_dirty(end) : end;
+		if (highlight.first_dirty < highlight.num_states) {  /* Lines after may be out of date */
+			highlight.states[highlight.first_dirty] |= STATE_DIRTY;
+			highlight.last_dirty = max(highlight.last_dirty, highlight.first_dirty + 1);
+		}
+	}
+	for (size_t i = job->runs_first; i < min(job->runs_end, end); i++) {
+		struct CachedRuns *lexed = &job->runs[i - job->runs_first];
+		struct CachedRuns *entry = claim_cached_runs(i);
+		struct CachedRuns swapped = *entry;
+		*entry = *lexed;
+		entry->line = i;
+		entry->is_current = true;
+		entry->last_use = ++highlight.num_uses;
+		lexed->runs = swapped.runs;  /* Freed with the job */
+		mark_line_damaged(i);
+	}
+}
+
+/**
+ * Picks up the result of the worker. It is thrown away if the document
+ * was edited since the job was handed over.
+ */
+static void collect_job(void) {
+	pthread_mutex_lock(&worker.lock);
+	struct HighlightJob *job = worker.result;
+	worker.result = NULL;
+	pthread_mutex_unlock(&worker.lock);
+	if (job == NULL) return;
+	if (job->version == editor.document->version) {
+		apply_job(job);
+	}
+	highlight.num_lexed += job->num_lexed;
+	highlight.job = NULL;
+	free_job(job);
+}
+
+/**
+ * Hands the next lines to lex to the worker: those up to the end of the
+ * screen whose states are out of date, then the lines on the screen
+ * without current runs, then the rest of the document. Streamed documents
+ * are only lexed up to the screen, as reading ahead would page them in.
+ */
+static bool submit_next_job(void) {
+	size_t num_lines = editor.document->num_lines;
+	size_t first = min(editor.line_offset, num_lines);
+	size_t end = min(editor.line_offset + editor.height, num_lines);
+	if (highlight.first_dirty < end) {
+		submit_job(highlight.first_dirty, job_lines, first, end, false);
+		return true;
+	}
+	while (first < end and has_current_runs(first)) first++;
+	if (first < end) {
+		submit_job(first, end - first, first, end, true);
+		return true;
+	}
+	if (highlight.first_dirty < num_lines and editor.document->stream == NULL) {
+		submit_job(highlight.first_dirty, job_lines, 0, 0, false);
+		return true;
+	}
+	return false;
+}
+
+void update_highlight(void) {
+	if (not highlight.is_enabled) return;
+	bool was_busy = highlight.is_busy;
+	if (highlight.job != NULL) {
+		collect_job();
+	}
+	highlight.is_busy = highlight.job != NULL or submit_next_job();
+	if (highlight.is_busy != was_busy) {
+		update_input_timeout();
+	}
+}
+
+bool is_highlighting(void) {
+	return highlight.is_busy;
+}
+
+const struct TokenRun* highlight_line(size_t index, size_t *n) {
+	static const struct TokenRun plain = {0, TOKEN_TEXT};
+	struct CachedRuns *entry = highlight.is_enabled ? find_cached_runs(index) : NULL;
+	if (entry == NULL) {
+		*n = 1;
+		return &plain;
+	}
+	entry->last_use = ++highlight.num_uses;
+	*n = entry->num_runs;
+	return entry->runs;
+}
+
+static size_t shift_line(size_t line, size_t first, size_t removed, size_t inserted) {
+	return line >= first + removed ? line - removed + inserted : line;
+}
+
+void invalidate_highlight(struct TextDocument *doc, size_t line, size_t removed, size_t inserted) {
+	if (doc != editor.document or not highlight.is_enabled) return;
+	for (size_t i = 0; i < RUN_CACHE_SIZE; i++) {
+		struct CachedRuns *entry = &highlight.cache[i];
+		if (entry->line >= line and entry->line < line + removed) {
+			entry->is_current = false;
+			if (entry->line >= line + inserted) {
+				entry->last_use = 0;
+			}
+		}
+		entry->line = shift_line(entry->line, line, removed, inserted);
+	}
+	if (line >= highlight.num_states) return;
+	if (line + removed >= highlight.num_states) {  /* The rest was not lexed yet */
+		highlight.num_states = line;
+		highlight.first_dirty = min(highlight.first_dirty, line);
+		highlight.last_dirty = min(highlight.last_dirty, line);
+		return;
+	}
+	size_t num_states = highlight.num_states - removed + inserted;
+	if (num_states > highlight.capacity) {
+		highlight.capacity = max(num_states, 2 * highlight.capacity);
+		highlight.states = realloc(highlight.states, highlight.capacity);
+	}
+	memmove(
+		&highlight.states[line + inserted], &highlight.states[line + removed],
+		highlight.num_states - (line + removed)
+	);
+	for (size_t i = line; i < line + inserted; i++) {  /* Keep end states of lines edited in place */
+		highlight.states[i] = (i < line + removed ? highlight.states[i] : STATE_UNKNOWN) | STATE_DIRTY;
+	}
+	highlight.num_states = num_states;
+	if (removed != inserted) {  /* The line after got another one before it */
+		highlight.states[line + inserted] |= STATE_DIRTY;
+	}
+	highlight.last_dirty = max(shift_line(highlight.last_dirty, line, removed, inserted), line + inserted + 1);
+	highlight.first_dirty = min(shift_line(highlight.first_dirty, line, removed, inserted), line);
+}
+
+static bool is_source_file(const char *path) {
+	const char *extension = strrchr(path, '.');
+	if (extension == NULL) return false;
+	for (size_t i = 0; i < lengthof(source_extensions); i++) {
+		if (strcmp(extension, source_extensions[i]) == 0) return true;
+	}
+	return false;
+}
+
+void begin_highlight(void) {
+	end_highlight();
+	highlight.is_enabled = is_source_file(editor.document->path);
+	if (highlight.is_enabled) {
+		start_highlight_worker();
+	}
+}
+
+void end_highlight(void) {
+	if (highlight.is_enabled) {
+		stop_highlight_worker();
+		free_job(highlight.job);
+	}
+	for (size_t i = 0; i < RUN_CACHE_SIZE; i++) {
+		free(highlight.cache[i].runs);
+	}
+	free(highlight.states);
+	memset(&highlight, 0, sizeof(highlight));
+}
+
+size_t count_lexed_lines(void) {
+	return highlight.num_lexed;
+}
@@ -0,0 +1,351 @@
+#include "clide.h"
+
+/**
+ * A change to the document: text that was inserted or deleted at a
+ * position. Undoing an insertion deletes the text again and undoing a
+ * deletion inserts it, so both cost the size of the change only.
+ * Replacements are stored as one change whose text holds a ReplacedText
+ * header with the old and the new text after it for every replacement.
+ * They count as insertions of the new text.
+ * All line and column numbers stored here are NORMALIZED!
+ */
+struct Change {
+	size_t line, column;  /* start of the text */
+	size_t end_line, end_column;  /* end of the text while it is inserted */
+	char *text;  /* NULL if spilled to the spill file */
+	size_t length;
+	off_t spill_offset;
+	bool is_insertion;
+	bool is_replacement;
+};
+
+struct ReplacedText {
+	size_t line, column;  /* before any of the replacements */
+	size_t length;  /* of the old text */
+	size_t text_length;  /* of the new text */
+};
+
+/**
+ * Changes before position can be undone, those from position on redone.
+ * Once the text of the changes held in memory exceeds the history limit,
+ * the text of the oldest ones is moved to the spill file, a temporary
+ * file which is appended to and read back only when they are undone.
+ */
+struct History {
+	struct Change *changes;
+	size_t num_changes;
+	size_t capacity;
+	size_t position;
+	size_t first_resident;  /* the text of changes before is spilled */
+	size_t resident_size;  /* bytes of text in memory */
+	FILE *spill;
+	off_t spill_size;
+	bool is_sealed;  /* the last change may not be extended */
+};
+
+static struct History history;
+
+static void find_end_of_text(struct Change *change) {
+	change->end_line = change->line;
+	change->end_column = change->column;
+	const char *begin = change->text;
+	const char *end = change->text + change->length;
+	for (const char *p = begin; (p = memchr(p, '\n', end - p)) != NULL; begin = ++p) {
+		change->end_line++;
+		change->end_column = 0;
+	}
+	change->end_column += end - begin;
+}
+
+static void spill_change(struct Change *change) {
+	if (history.spill == NULL) {
+		history.spill = tmpfile();
+		if (history.spill == NULL) return;
+	}
+	if (pwrite(fileno(history.spill), change->text, change->length, history.spill_size) != change->length) {
+		return;  /* Keep the text in memory */
+	}
+	change->spill_offset = history.spill_size;
+	history.spill_size += change->length;
+	history.resident_size -= change->length;
+	free(change->text);
+	change->text = NULL;
+}
+
+static void enforce_history_limit(void) {
+	while (history.resident_size > config.history_limit and history.first_resident < history.num_changes) {
+		struct Change *change = &history.changes[history.first_resident];
+		spill_change(change);
+		if (change->text != NULL) break;
+		history.first_resident++;
+	}
+}
+
+/**
+ * Drops the changes that could be redone. Their spilled text is at the
+ * end of the spill file, which is cut off.
+ */
+static void drop_undone_changes(void) {
+	for (size_t i = history.position; i < history.num_changes; i++) {
+		struct Change *change = &history.changes[i];
+		if (change->text == NULL) {
+			history.spill_size = min(history.spill_size, change->spill_offset);
+		} else {
+			history.resident_size -= change->length;
+			free(change->text);
+		}
+	}
+	if (history.spill != NULL and history.num_changes > history.position) {
+		ftruncate(fileno(history.spill), history.spill_size);
+	}
+	history.num_changes = history.position;
+	history.first_resident = min(history.first_resident, history.num_changes);
+}
+
+static struct Change* append_change(bool is_insertion, size_t line, size_t column, char *text, size_t length) {
+	drop_undone_changes();
+	if (history.num_changes >= history.capacity) {
+		history.capacity = history.capacity ? 2 * history.capacity : 64;
+		history.changes = realloc(history.changes, sizeof(*history.changes) * history.capacity);
+	}
+	struct Change *change = &history.changes[history.num_changes++];
+	change->is_insertion = is_insertion;
+	change->is_replacement = false;
+	change->line = line;
+	change->column = column;
+	change->text = text;
+	change->length = length;
+	history.position = history.num_changes;
+	history.resident_size += length;
+	history.is_sealed = false;
+	return change;
+}
+
+/**
+ * Returns the last change if the next one may be merged into it.
+ */
+static struct Change* extensible_change(bool is_insertion) {
+	if (history.is_sealed or history.position == 0 or history.position < history.num_changes) {
+		return NULL;
+	}
+	struct Change *change = &history.changes[history.position - 1];
+	if (change->is_insertion != is_insertion or change->text == NULL) {
+		return NULL;
+	}
+	return change;
+}
+
+void record_insertion(size_t line, size_t column, const char *text, size_t length) {
+	bool is_typed = memchr(text, '\n', length) == NULL;
+	struct Change *last = extensible_change(true);
+	if (
+		is_typed and last != NULL and
+		last->end_line == line and last->end_column == column
+	) {  /* Consecutive typing, insertions with newlines are sealed */
+		last->text = realloc(last->text, last->length + length);
+		memcpy(last->text + last->length, text, length);
+		last->length += length;
+		last->end_column += length;
+		history.resident_size += length;
+	} else {
+		char *copy = malloc(length);
+		memcpy(copy, text, length);
+		find_end_of_text(append_change(true, line, column, copy, length));
+		history.is_sealed = not is_typed;
+	}
+	enforce_history_limit();
+}
+
+/**
+ * Returns true if the text is a single character, as deleted by a key.
+ */
+static bool is_single_character(const char *text, size_t length) {
+	uint32_t codepoint;
+	return length > 0 and decode_character(text, length, &codepoint) == length;
+}
+
+/**
+ * The end of the deleted text while it is inserted is where the deleted
+ * range ended. Characters deleted with backspace move the start back to
+ * them, which leaves the end where it is, and those deleted in front of
+ * the cursor move the end.
+ */
+void record_deletion(size_t line, size_t column, size_t end_line, size_t end_column) {
+	size_t length;
+	char *text = copy_text(editor.document, line, column, end_line, end_column, &length);
+	bool is_key = is_single_character(text, length);
+	struct Change *last = extensible_change(false);
+	if (is_key and last != NULL and end_line == last->line and end_column == last->column) {
+		last->text = realloc(last->text, last->length + length);  /* Backspace */
+		memmove(last->text + length, last->text, last->length);
+		memcpy(last->text, text, length);
+		last->line = line;
+		last->column = column;
+		last->length += length;
+		history.resident_size += length;
+		free(text);
+	} else if (is_key and last != NULL and line == last->line and column == last->column) {
+		last->text = realloc(last->text, last->length + length);  /* Delete */
+		memcpy(last->text + last->length, text, length);
+		last->length += length;
+		if (text[0] == '\n') {
+			last->end_line++;
+			last->end_column = 0;
+		} else {
+			last->end_column += length;
+		}
+		history.resident_size += length;
+		free(text);
+	} else {
+		struct Change *change = append_change(false, line, column, text, length);
+		change->end_line = end_line;
+		change->end_column = end_column;
+		history.is_sealed = not is_key;
+	}
+	enforce_history_limit();
+}
+
+void record_replacements(const struct Replacement *replacements, size_t n) {
+	size_t length = 0;
+	for (size_t i = 0; i < n; i++) {
+		length += sizeof(struct ReplacedText) + replacements[i].length + replacements[i].text_length;
+	}
+	char *text = malloc(length), *out = text;
+	struct Line *line = NULL;
+	for (size_t i = 0; i < n; i++) {
+		const struct Replacement *replacement = &replacements[i];
+		if (i == 0 or replacement->line != replacements[i - 1].line) {
+			line = *get_line(editor.document, replacement->line);
+		}
+		struct ReplacedText header = {
+			replacement->line, replacement->column,
+			replacement->length, replacement->text_length
+		};
+		memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+		size_t end = replacement->column + replacement->length;
+		for (size_t position = replacement->column, m; position < end; position += m) {
+			const char *segment = segment_of(line, position, &m);
+			m = min(m, end - position);
+			memcpy(out, segment, m);
+			out += m;
+		}
+		memcpy(out, replacement->text, replacement->text_length);
+		out += replacement->text_length;
+	}
+	struct Change *change = append_change(true, replacements[0].line, replacements[0].column, text, length);
+	change->is_replacement = true;
+	change->end_line = change->line;
+	change->end_column = change->column;
+	history.is_sealed = true;
+	enforce_history_limit();
+}
+
+void seal_history(void) {
+	history.is_sealed = true;
+}
+
+static char* load_text(struct Change *change) {
+	if (change->text != NULL) {
+		return change->text;
+	}
+	char *text = malloc(change->length);
+	if (pread(fileno(history.spill), text, change->length, change->spill_offset) != change->length) {
+		memset(text, '?', change->length);  /* Spill file was damaged */
+	}
+	return text;
+}
+
+/**
+ * Replaces the old texts of a replacement change by the new ones, or the
+ * other way round, where the columns are shifted by the texts before.
+ */
+static void apply_replacements(struct Change *change, bool is_insertion) {
+	char *text = load_text(change);
+	size_t n = 0;
+	for (size_t offset = 0; offset < change->length; n++) {
+		struct ReplacedText header;
+		memcpy(&header, text + offset, sizeof(header));
+		offset += sizeof(header) + header.length + header.text_length;
+	}
+	struct Replacement *replacements = malloc(sizeof(*replacements) * n);
+	size_t shift = 0;  /* of columns within the line by the texts before */
+	for (size_t i = 0, offset = 0; i < n; i++) {
+		struct ReplacedText header;
+		memcpy(&header, text + offset, sizeof(header));
+		const char *old_text = text + offset + sizeof(header);
+		const char *new_text = old_text + header.length;
+		offset += sizeof(header) + header.length + header.text_length;
+		if (i > 0 and replacements[i - 1].line != header.line) {
+			shift = 0;
+		}
+		struct Replacement *replacement = &replacements[i];
+		replacement->line = header.line;
+		if (is_insertion) {
+			replacement->column = header.column;
+			replacement->length = header.length;
+			replacement->text = new_text;
+			replacement->text_length = header.text_length;
+		} else {
+			replacement->column = header.column + shift;
+			replacement->length = header.text_length;
+			replacement->text = old_text;
+			replacement->text_length = header.length;
+			shift += header.text_length - header.length;
+		}
+	}
+	replace_text(editor.document, replacements, n);
+	free(replacements);
+	if (text != change->text) {
+		free(text);
+	}
+}
+
+/**
+ * Inserts or deletes the text of a change and moves the position
+ * to the end of an insertion or the start of a deletion.
+ */
+static void apply_change(struct Change *change, bool is_insertion, size_t *line, size_t *column) {
+	*line = change->line;
+	*column = change->column;
+	if (change->is_replacement) {
+		apply_replacements(change, is_insertion);
+	} else if (is_insertion) {
+		char *text = load_text(change);
+		insert_text(&editor.document, line, column, text, change->length);
+		if (text != change->text) {
+			free(text);
+		}
+	} else {
+		delete_range(&editor.document, change->line, change->column, change->end_line, change->end_column);
+	}
+	history.is_sealed = true;
+}
+
+bool undo_change(size_t *line, size_t *column) {
+	if (history.position == 0) {
+		return false;
+	}
+	struct Change *change = &history.changes[--history.position];
+	apply_change(change, not change->is_insertion, line, column);
+	return true;
+}
+
+bool redo_change(size_t *line, size_t *column) {
+	if (history.position == history.num_changes) {
+		return false;
+	}
+	struct Change *change = &history.changes[history.position++];
+	apply_change(change, change->is_insertion, line, column);
+	return true;
+}
+
+void clear_history(void) {
+	history.position = 0;
+	drop_undone_changes();
+	free(history.changes);
+	if (history.spill != NULL) {
+		fclose(history.spill);
+	}
+	memset(&history, 0, sizeof(history));
+}
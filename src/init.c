@@ -12,10 +12,12 @@ static void apply_color_theme(void) {
 		init_pair(10, COLOR_WHITE, COLOR_BLACK);
 		attron(COLOR_PAIR(10));
 		bkgd(COLOR_PAIR(10));
+		init_token_colors(COLOR_BLACK);
 	} else if (!strcmp(config.theme, "bright")) {
 		init_pair(10, COLOR_BLACK, COLOR_WHITE);
 		attron(COLOR_PAIR(10));
 		bkgd(COLOR_PAIR(10));
+		init_token_colors(COLOR_WHITE);
 	}
 	/* Invalid color themes are ignored */
 }
@@ -28,10 +30,12 @@ void initialize_clide(void) {
 		| BUTTON4_PRESSED /* Mousewheel */
 		| BUTTON5_PRESSED /* Mousewheel */
 	);
+	setlocale(LC_ALL, "");  /* let curses draw UTF-8 */
 	initscr();  /* initialize ncurses */
 	raw();  /* disable tty buffering */
 	noecho();  /* disable tty input echoing */
 	keypad(stdscr, TRUE);  /* enable extended key support */
+	idlok(stdscr, TRUE);  /* let scrolled pages reuse the terminal scroll region */
 	mousemask(mouse_mask, NULL);  /* activate mouse event filter */
 	mouseinterval(10);  /* set mouse event trigger interval */
 	signal(SIGSEGV, signal_handler);  /* ensure graceful exit on event */
@@ -43,9 +47,15 @@ void initialize_clide(void) {
 		apply_color_theme();
 	}
 	update_terminal_dimensions();
+	/* Until curses has been suspended and resumed once, it flushes its output
+	 * after every cursor movement, which splits each screen update into one
+	 * write per line. Doing so right away makes updates go out in one write. */
+	endwin();
+	refresh();
+	enable_bracketed_paste();
 }
 
 void quit_clide(void) {
-	clear_clipboard();
+	disable_bracketed_paste();
 	endwin();
 }
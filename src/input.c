@@ -12,6 +12,20 @@
 #define KEY_SHIFT_DOWN        336
 #define KEY_CTRL_DC           524
 #define KEY_CTRL_BACKSPACE      8
+#define KEY_PASTE_BEGIN       (KEY_MAX + 1)
+#define KEY_PASTE_END         (KEY_MAX + 2)
+
+/* Bracketed paste mode makes the terminal enclose pasted text in these */
+static const char paste_begin_marker[] = "\033[200~";
+static const char paste_end_marker[] = "\033[201~";
+
+/* Pastes whose end marker does not arrive in time end there */
+static const int paste_timeout = 1000;
+
+/* Set when a paste timed out, its rest is inserted when it arrives */
+static bool is_pasting_late;
+
+static const size_t paste_block_size = 1 << 16;
 
 /**
  * The document editor has a title bar at the top and a status bar at the bottom.
@@ -28,51 +42,51 @@ static bool is_within_editor_bounds(int y, int x) {
 	);
 }
 
-static void handle_mouse_event(void) {
-	MEVENT event;
-	if (getmouse(&event) == OK) {
-		if (event.bstate & BUTTON1_PRESSED and is_within_editor_bounds(event.y, event.x)) {
-			update_cursor_reverse(event.y, event.x);
-			begin_selection();
-		}
-		else if (event.bstate & BUTTON1_RELEASED and is_within_editor_bounds(event.y, event.x)) {
-			update_cursor_reverse(event.y, event.x);
-			update_selection();
+static void handle_mouse_event(MEVENT *event) {
+	if (event->bstate & BUTTON1_PRESSED and is_within_editor_bounds(event->y, event->x)) {
+		update_cursor_reverse(event->y, event->x);
+		begin_selection();
+	}
+	else if (event->bstate & BUTTON1_RELEASED and is_within_editor_bounds(event->y, event->x)) {
+		update_cursor_reverse(event->y, event->x);
+		update_selection();
+	}
+	if (event->bstate & BUTTON4_PRESSED) {  /* scrollwheel down */
+		if (can_scroll(-1)) {
+			scroll_page(-1);
+			move_up();
 		}
-		if (event.bstate & BUTTON4_PRESSED) {  /* scrollwheel down */
-			if (can_scroll(-1)) {
-				scroll_page(-1);
-				move_up();
-			}
-		} else if (event.bstate & BUTTON5_PRESSED) {  /* scrollwheel up */
-			if (can_scroll(1)) {
-				scroll_page(1);
-				move_down();
-			}
+	} else if (event->bstate & BUTTON5_PRESSED) {  /* scrollwheel up */
+		if (can_scroll(1)) {
+			scroll_page(1);
+			move_down();
 		}
 	}
 }
 
 static void handle_resize_event(void) {
 	update_terminal_dimensions();
-	clear();
-	print_title_bar();
-	print_page();
+	mark_screen_damaged();
 }
 
 bool handle_input(int key) {
+	MEVENT event;
 	switch (key) {
 		default:
 			invalidate_selection();
 			insert_character_at_current_position(key);
 			move_right();
-			print_current_line();
+			break;
+		case ERR:  /* No input within timeout */
+			poll_document_editor();
 			break;
 		case KEY_RESIZE:
 			handle_resize_event();
 			break;
 		case KEY_MOUSE:
-			handle_mouse_event();
+			if (getmouse(&event) == OK) {
+				handle_mouse_event(&event);
+			}
 			break;
 		case KEY_HOME:
 			invalidate_selection();
@@ -189,22 +203,18 @@ bool handle_input(int key) {
 			if (can_move_left()) {
 				move_left();
 				delete_character_at_current_position();
-				print_current_line();
 			} else if (can_move_up()) {
 				move_up();
 				move_to_end_of_line();
 				merge_with_next_line();
-				print_page();
 			}
 			break;
 		case KEY_DC:
 			invalidate_selection();
 			if (can_move_right()) {
 				delete_character_at_current_position();
-				print_current_line();
 			} else if (can_move_down()) {
 				merge_with_next_line();
-				print_page();
 			}
 			break;
 		case KEY_CTRL_BACKSPACE:
@@ -217,7 +227,6 @@ bool handle_input(int key) {
 				move_left();
 				delete_character_at_current_position();
 			}
-			print_current_line();
 			break;
 		case KEY_CTRL_DC:
 			invalidate_selection();
@@ -227,7 +236,6 @@ bool handle_input(int key) {
 			while (can_move_right() and isalnum(current_character(0))) {
 				delete_character_at_current_position();
 			}
-			print_current_line();
 			break;
 		case CTRL('q'):  /* quit */
 			return false;
@@ -240,34 +248,307 @@ bool handle_input(int key) {
 		case CTRL('v'):  /* paste clipboard */
 			paste_clipboard();
 			break;
+		case CTRL('p'):  /* paste older clip instead */
+			paste_older_clip();
+			break;
 		case CTRL('x'):  /* cut selection */
 			cut_current_selection();
 			break;
-		case CTRL('g'):  /* goto line */
-			editor.line = launch_goto_line_dialog();
-			editor.column = 1;
+		case CTRL('g'):  /* goto line or byte offset */
+			editor.line = launch_goto_line_dialog(&editor.column);
 			editor.line_offset = min(normalize(editor.line) - editor.height/2, 0);
 			update_current_cursor();
-			print_page();
+			mark_screen_damaged();
+			break;
+		case KEY_F(2):  /* Ctrl+I is the same key code as tab */
+			launch_info_dialog();
+			mark_screen_damaged();
 			break;
 		case CTRL('s'):  /* save document */
-			save_document(editor.document);
-			editor.was_modified = false;
-			print_title_bar();
+			save_document_editor();
+			break;
+		case CTRL('z'):  /* undo */
+			invalidate_selection();
+			undo_last_change();
+			break;
+		case CTRL('y'):  /* redo */
+			invalidate_selection();
+			redo_last_change();
 			break;
 		case CTRL('f'):  /* find text */
+			invalidate_selection();
 			launch_find_text_dialog();
+			mark_screen_damaged();
+			break;
+		case KEY_F(3):  /* find next match */
+			invalidate_selection();
+			if (not move_to_next_match()) {
+				show_status_message("No match");
+			}
 			break;
 		case CTRL('r'):  /* replace text */
+			invalidate_selection();
 			launch_replace_text_dialog();
+			mark_screen_damaged();
 			break;
 		case '\n':
 			invalidate_selection();
 			insert_line_at_current_position();
 			move_down();
 			move_to_beginning_of_line();
-			print_page();
 			break;
 	}
 	return true;
-}
\ No newline at end of file
+}
+
+/**
+ * Input that is already queued when a key arrives, as with key repeat,
+ * pasted text or a spinning mouse wheel, is handled as a whole. Runs of
+ * text are inserted at once and wheel events add up to a single scroll.
+ */
+struct InputBatch {
+	char *text;
+	size_t length;
+	size_t capacity;
+	int scroll;
+};
+
+static struct InputBatch batch;
+
+static bool is_text_key(int key) {
+	return (key >= ' ' and key < 256 and key != 127) or key == '\t' or key == '\n';
+}
+
+static int wheel_delta(MEVENT *event) {
+	if (event->bstate & (BUTTON1_PRESSED | BUTTON1_RELEASED)) return 0;
+	if (event->bstate & BUTTON4_PRESSED) return -1;
+	if (event->bstate & BUTTON5_PRESSED) return 1;
+	return 0;
+}
+
+static void insert_batched_text(void) {
+	if (batch.length > 0) {
+		invalidate_selection();
+		insert_text_at_current_position(batch.text, batch.length);
+		batch.length = 0;
+		signal_modification();
+		update_current_cursor();
+	}
+}
+
+/**
+ * The cursor keeps its row on the screen, as with single wheel events.
+ */
+static void apply_batched_scroll(void) {
+	int n = batch.scroll;
+	while (n != 0 and not can_scroll(n)) {
+		n -= n > 0 ? 1 : -1;
+	}
+	if (n != 0) {
+		scroll_page(n);
+		editor.line += n;
+		update_current_cursor();
+	}
+	batch.scroll = 0;
+}
+
+static void reserve_batch(size_t n) {
+	while (batch.capacity - batch.length < n) {
+		batch.capacity = batch.capacity ? 2 * batch.capacity : 256;
+		batch.text = realloc(batch.text, batch.capacity);
+	}
+}
+
+static void append_batched_key(int key) {
+	reserve_batch(1);
+	batch.text[batch.length++] = key;
+}
+
+/**
+ * Returns the position of the paste end marker in the batch, or the
+ * length of the batch if it is not there.
+ */
+static size_t find_paste_end(size_t start) {
+	const size_t n = sizeof(paste_end_marker) - 1;
+	const char *end = batch.text + batch.length;
+	for (const char *p = batch.text + start; (p = memchr(p, '\033', end - p)) != NULL; p++) {
+		if ((size_t)(end - p) >= n and memcmp(p, paste_end_marker, n) == 0) {
+			return p - batch.text;
+		}
+	}
+	return batch.length;
+}
+
+/**
+ * Terminals send line breaks as carriage returns, which curses would
+ * otherwise have translated.
+ */
+static void translate_line_breaks(size_t start) {
+	size_t length = start;
+	for (size_t i = start; i < batch.length; i++) {
+		if (batch.text[i] == '\r' and i + 1 < batch.length and batch.text[i + 1] == '\n') {
+			continue;
+		}
+		batch.text[length++] = batch.text[i] == '\r' ? '\n' : batch.text[i];
+	}
+	batch.length = length;
+}
+
+/**
+ * Translates the key at the beginning of the given bytes like curses
+ * would with the keypad enabled, and stores the number of bytes it took.
+ * key_defined also accepts bytes after a key, hence the shortest match.
+ */
+static int translate_key(const char *bytes, size_t n, size_t *length) {
+	char sequence[16];
+	for (size_t k = 2; bytes[0] == '\033' and k <= min(n, sizeof(sequence) - 1); k++) {
+		memcpy(sequence, bytes, k);
+		sequence[k] = '\0';
+		int key = key_defined(sequence);
+		if (key > 0) {
+			*length = k;
+			return key;
+		}
+	}
+	*length = 1;
+	return bytes[0] == '\r' ? '\n' : (unsigned char)bytes[0];
+}
+
+/**
+ * Bytes which were read past the end of a paste, to be handled as keys
+ * before curses is asked for more. They are kept untranslated, so that
+ * a paste beginning among them can take its text from here.
+ */
+struct KeyQueue {
+	char *bytes;
+	size_t length;
+	size_t next;
+};
+
+static struct KeyQueue pending;
+
+static void queue_keys(const char *bytes, size_t n) {
+	pending.length -= pending.next;
+	memmove(pending.bytes, pending.bytes + pending.next, pending.length);
+	pending.next = 0;
+	pending.bytes = realloc(pending.bytes, pending.length + n);
+	memcpy(pending.bytes + pending.length, bytes, n);
+	pending.length += n;
+}
+
+static int read_key(void) {
+	if (pending.next < pending.length) {
+		size_t length;
+		int key = translate_key(pending.bytes + pending.next, pending.length - pending.next, &length);
+		pending.next += length;
+		return key;
+	}
+	return getch();
+}
+
+/**
+ * Reads pasted text up to the end marker into the batch. Curses reads its
+ * input a byte at a time, which is far too slow for large pastes, so the
+ * text is read from the terminal directly. Having just matched the begin
+ * marker, curses has nothing left buffered, but the queue may hold the
+ * beginning of the text. Whatever arrives after the end marker is queued
+ * as keys. If the end marker does not arrive in time, the text so far is
+ * inserted and reading resumes with the next text key. A resumed paste
+ * which times out again is cut short there.
+ */
+static void read_bracketed_paste(bool is_resumed) {
+	const size_t n = sizeof(paste_end_marker) - 1;
+	const size_t start = batch.length;
+	struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+	reserve_batch(pending.length - pending.next);
+	memcpy(batch.text + batch.length, pending.bytes + pending.next, pending.length - pending.next);
+	batch.length += pending.length - pending.next;
+	pending.next = pending.length;
+	size_t end = find_paste_end(start);
+	while (end == batch.length and poll(&input, 1, paste_timeout) > 0) {
+		reserve_batch(paste_block_size);
+		ssize_t count = read(STDIN_FILENO, batch.text + batch.length, paste_block_size);
+		if (count <= 0) break;
+		size_t searched = max(start, batch.length - min(batch.length, n - 1));
+		batch.length += count;
+		end = find_paste_end(searched);
+	}
+	if (end < batch.length) {
+		queue_keys(batch.text + end + n, batch.length - end - n);
+		batch.length = end;
+	}
+	is_pasting_late = end == batch.length and not is_resumed;
+	if (end == batch.length and is_resumed) {
+		show_status_message("Paste was cut short");
+	}
+	translate_line_breaks(start);
+}
+
+void enable_bracketed_paste(void) {
+	define_key(paste_begin_marker, KEY_PASTE_BEGIN);
+	define_key(paste_end_marker, KEY_PASTE_END);
+	printf("\033[?2004h");
+	fflush(stdout);
+}
+
+void disable_bracketed_paste(void) {
+	printf("\033[?2004l");
+	fflush(stdout);
+}
+
+bool handle_pending_input(void) {
+	int key = read_key();
+	if (key == ERR) {
+		return handle_input(key);
+	}
+	clear_status_message();
+	bool is_running = true;
+	nodelay(stdscr, TRUE);
+	while (is_running and key != ERR) {
+		MEVENT event;
+		bool is_late_paste = is_pasting_late and is_text_key(key);
+		if (is_pasting_late and not is_late_paste) {
+			is_pasting_late = false;
+			if (key != KEY_PASTE_END) {
+				show_status_message("Paste was cut short");
+			}
+		}
+		if (key == KEY_PASTE_END) {
+			/* Stray end of a paste that timed out, dropped */
+		} else if (is_text_key(key) and not is_late_paste) {
+			apply_batched_scroll();
+			append_batched_key(key);
+		} else if (key == KEY_PASTE_BEGIN or is_late_paste) {  /* Inserted in one go */
+			insert_batched_text();
+			apply_batched_scroll();
+			if (is_late_paste) {
+				append_batched_key(key);
+			}
+			read_bracketed_paste(is_late_paste);
+			seal_history();
+			insert_batched_text();
+			seal_history();
+		} else if (key == KEY_MOUSE) {
+			if (getmouse(&event) == OK) {
+				insert_batched_text();
+				if (wheel_delta(&event) != 0) {
+					batch.scroll += wheel_delta(&event);
+				} else {
+					apply_batched_scroll();
+					handle_mouse_event(&event);
+				}
+			}
+		} else {
+			insert_batched_text();
+			apply_batched_scroll();
+			is_running = handle_input(key);
+		}
+		if (is_running) {
+			key = read_key();
+		}
+	}
+	insert_batched_text();
+	apply_batched_scroll();
+	poll_document_editor();
+	return is_running;
+}
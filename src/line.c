@@ -1,82 +1,566 @@
 #include "clide.h"
 
-char* text_of(struct Line *line) {
+static bool line_is_view(struct Line *line) {
+	return line->capacity == 0;
+}
+
+static bool line_is_long(struct Line *line) {
+	return line->capacity == LONG_LINE_CAPACITY;
+}
+
+/* Retrieves the writable string of characters of a plain line */
+static char* buffer_of(struct Line *line) {
+	assert (not line_is_view(line) and not line_is_long(line));
 	return (char*)(line + 1);
 }
 
-static struct Line* allocate_line_memory(struct Line *line, size_t n) {
-	line = realloc(line, sizeof(*line) + sizeof(char) * n);
-	line->capacity = n;
+static size_t gap_size_of(struct Line *line) {
+	return line->capacity - line->length;
+}
+
+/**
+ * Moves the gap of the line to the given position. Only the characters
+ * between the old and the new position of the gap are moved.
+ */
+static void move_gap(struct Line *line, size_t position) {
+	char *buffer = buffer_of(line);
+	size_t gap_size = gap_size_of(line);
+	if (position < line->gap) {
+		memmove(buffer + position + gap_size, buffer + position, line->gap - position);
+	} else if (position > line->gap) {
+		memmove(buffer + line->gap, buffer + line->gap + gap_size, position - line->gap);
+	}
+	line->gap = position;
+}
+
+size_t length_of(struct Line *line) {
+	if (line_is_view(line)) {
+		return ((struct LineView*)line)->length;
+	} else if (line_is_long(line)) {
+		return ((struct LongLine*)line)->length;
+	}
+	return line->length;
+}
+
+/**
+ * Returns the index of the chunk holding the character at position.
+ * The end of the line belongs to the last chunk.
+ */
+static size_t find_chunk(struct LongLine *line, size_t position) {
+	size_t low = 0, high = line->num_chunks;
+	while (high - low > 1) {
+		size_t middle = (low + high) / 2;
+		if (line->starts[middle] <= position) low = middle;
+		else high = middle;
+	}
+	return low;
+}
+
+int character_of(struct Line *line, size_t position) {
+	assert (position < length_of(line));
+	if (line_is_view(line)) {
+		return ((struct LineView*)line)->text[position];
+	} else if (line_is_long(line)) {
+		struct LongLine *long_line = (struct LongLine*)line;
+		size_t i = find_chunk(long_line, position);
+		return character_of(long_line->chunks[i], position - long_line->starts[i]);
+	}
+	if (position >= line->gap) {
+		position += gap_size_of(line);
+	}
+	return buffer_of(line)[position];
+}
+
+const char* segment_of(struct Line *line, size_t position, size_t *length) {
+	assert (position <= length_of(line));
+	if (line_is_view(line)) {
+		*length = ((struct LineView*)line)->length - position;
+		return ((struct LineView*)line)->text + position;
+	} else if (line_is_long(line)) {
+		struct LongLine *long_line = (struct LongLine*)line;
+		size_t i = find_chunk(long_line, position);
+		return segment_of(long_line->chunks[i], position - long_line->starts[i], length);
+	} else if (position < line->gap) {
+		*length = line->gap - position;
+		return buffer_of(line) + position;
+	}
+	*length = line->length - position;
+	return buffer_of(line) + position + gap_size_of(line);
+}
+
+static size_t line_size(struct Line *line) {
+	return sizeof(*line) + line->capacity;
+}
+
+/**
+ * Each snapshot starts a new generation of lines. Lines of the generations
+ * before are frozen while the snapshot is in use, and freed lines which it
+ * may still refer to are retired until then. Generation zero is reserved
+ * for lines aged by age_line, the last one for shared lines.
+ */
+struct LineSnapshot {
+	uint16_t generation;
+	bool is_active;
+	struct Line **retired;
+	size_t num_retired;
+	size_t capacity;
+};
+
+static struct LineSnapshot snapshot = {1, false, NULL, 0, 0};
+
+/**
+ * Shared lines are marked by a generation that no snapshot takes, so that
+ * they are frozen while one is in use as well.
+ */
+#define SHARED_GENERATION UINT16_MAX
+
+static bool line_is_frozen(struct Line *line) {
+	return snapshot.is_active and line->generation != snapshot.generation;
+}
+
+static bool line_is_shared(struct Line *line) {
+	return line->generation == SHARED_GENERATION;
+}
+
+/**
+ * The number of owners of a shared line is kept in the counter of its
+ * block, next to those of the lines allocated around it.
+ */
+struct Line* share_line(struct Line *line) {
+	uint32_t *num_owners = counter_of_block(line);
+	*num_owners = line_is_shared(line) ? *num_owners + 1 : 2;
+	line->generation = SHARED_GENERATION;
 	return line;
 }
 
-void clear_line(struct Line *line, size_t start) {
-	memset(text_of(line) + start, 0, line->capacity - start);
+/**
+ * Drops an owner of a shared line. Returns true if it was the last one.
+ */
+static bool release_line(struct Line *line) {
+	return --*counter_of_block(line) == 0;
+}
+
+static void retire_line(struct Line *line) {
+	if (snapshot.num_retired >= snapshot.capacity) {
+		snapshot.capacity = snapshot.capacity ? 2 * snapshot.capacity : 64;
+		snapshot.retired = realloc(snapshot.retired, sizeof(*snapshot.retired) * snapshot.capacity);
+	}
+	snapshot.retired[snapshot.num_retired++] = line;
+}
+
+bool begin_line_snapshot(void) {
+	assert (not snapshot.is_active);
+	snapshot.is_active = true;
+	if (++snapshot.generation == SHARED_GENERATION) {
+		snapshot.generation = 1;
+		return false;
+	}
+	return true;
+}
+
+void end_line_snapshot(void) {
+	assert (snapshot.is_active);
+	snapshot.is_active = false;
+	for (size_t i = 0; i < snapshot.num_retired; i++) {
+		free_line(snapshot.retired[i]);
+	}
+	free(snapshot.retired);
+	snapshot.retired = NULL;
+	snapshot.num_retired = snapshot.capacity = 0;
+}
+
+void age_line(struct Line *line) {
+	if (not line_is_shared(line)) {
+		line->generation = 0;
+	}
+}
+
+/**
+ * Allocates a plain line with room for at least n characters. The line
+ * gets the whole block as capacity. The characters of a previous line
+ * are moved over at the same offsets and its block is freed.
+ */
+static struct Line* allocate_line_memory(struct Line *line, size_t n) {
+	size_t size;
+	struct Line *result = allocate_block(sizeof(*line) + sizeof(char) * n, &size);
+	if (line != NULL) {
+		memcpy(result, line, line_size(line));
+		free_block(line, line_size(line));
+	} else {
+		result->generation = snapshot.generation;
+	}
+	result->capacity = size - sizeof(*line);
+	return result;
 }
 
 struct Line* create_line(void) {
 	static const size_t default_capacity = 128;
 	struct Line *line = allocate_line_memory(NULL, default_capacity);
-	clear_line(line, 0);
 	line->length = 0;
+	line->gap = 0;
+	return line;
+}
+
+/**
+ * Text that fits into a plain line is stored in the smallest block it fits,
+ * which is what loading documents relies on.
+ */
+struct Line* create_line_from_text(const char *text, size_t length) {
+	if (length > LINE_CHUNK_SIZE) {
+		struct Line *line = create_line();
+		append_text(&line, text, length);
+		return line;
+	}
+	struct Line *line = allocate_line_memory(NULL, length);
+	memcpy(buffer_of(line), text, length);
+	line->length = length;
+	line->gap = length;
 	return line;
 }
 
+struct Line* create_line_view(const char *text, size_t length) {
+	size_t size;
+	struct LineView *view = allocate_block(sizeof(*view), &size);
+	view->line.length = 0;
+	view->line.capacity = 0;
+	view->line.gap = 0;
+	view->line.generation = snapshot.generation;
+	view->text = text;
+	view->length = length;
+	return &view->line;
+}
+
 void free_line(struct Line *line) {
-	clear_line(line, 0);
-	free(line);
+	if (line_is_frozen(line)) {
+		retire_line(line);
+	} else if (line_is_shared(line) and not release_line(line)) {
+		return;  /* Still owned by others */
+	} else if (line_is_long(line)) {
+		struct LongLine *long_line = (struct LongLine*)line;
+		for (size_t i = 0; i < long_line->num_chunks; i++) {
+			free_line(long_line->chunks[i]);
+		}
+		free(long_line->chunks);
+		free(long_line->starts);
+		free_block(line, sizeof(*long_line));
+	} else if (line_is_view(line)) {
+		free_block(line, sizeof(struct LineView));
+	} else {
+		free_block(line, line_size(line));
+	}
 }
 
-static bool line_is_exhausted(struct Line *line) {
-	return line->length >= line->capacity;
+void unshare_line(struct Line **lineptr) {
+	struct Line *line = *lineptr;
+	if (line_is_frozen(line) or line_is_shared(line)) {
+		if (line_is_view(line)) {
+			struct LineView *view = (struct LineView*)line;
+			*lineptr = create_line_view(view->text, view->length);
+		} else {
+			*lineptr = create_line_from_text("", 0);
+			append_line_text(lineptr, line, 0);
+		}
+		free_line(line);  /* Retired or released */
+	}
 }
 
-static void extend_line_capacity(struct Line **lineptr) {
-	*lineptr = allocate_line_memory(*lineptr, 2 * (*lineptr)->capacity);
-	clear_line(*lineptr, (*lineptr)->length);  /* Clear extended section */
+/**
+ * Replaces a view by a private copy of its text before it gets modified.
+ */
+static void ensure_private_line(struct Line **lineptr) {
+	if (line_is_view(*lineptr)) {
+		struct LineView *view = (struct LineView*)*lineptr;
+		*lineptr = create_line_from_text(view->text, view->length);
+		free_line(&view->line);
+	}
 }
 
-void insert_character(struct Line **lineptr, size_t position, int ch) {
-	assert (position <= (*lineptr)->length);
-	(*lineptr)->length++;
-	if (line_is_exhausted(*lineptr)) {
-		extend_line_capacity(lineptr);
-	}
-	memmove(  /* Make room for the new character */
-		text_of(*lineptr) + position + 1,
-		text_of(*lineptr) + position,
-		(*lineptr)->length - position
+/**
+ * Grows a plain line so that at least n more characters fit into its gap.
+ * The characters after the gap are moved to the end of the new buffer.
+ */
+static void reserve_line_capacity(struct Line **lineptr, size_t n) {
+	struct Line *line = *lineptr;
+	assert (line->length + n <= LINE_CHUNK_SIZE);
+	if (gap_size_of(line) >= n) return;
+	size_t old_capacity = line->capacity;
+	size_t tail = line->length - line->gap;
+	size_t capacity = max(2 * old_capacity, line->length + n);
+	line = allocate_line_memory(line, min(capacity, LINE_CHUNK_SIZE));  /* May round up */
+	memmove(
+		buffer_of(line) + line->capacity - tail,
+		buffer_of(line) + old_capacity - tail,
+		tail
 	);
-	text_of(*lineptr)[position] = ch;
+	*lineptr = line;
+}
+
+static void insert_chunk(struct LongLine *line, size_t index, struct Line *chunk) {
+	if (line->num_chunks >= line->capacity) {
+		line->capacity *= 2;
+		line->chunks = realloc(line->chunks, sizeof(*line->chunks) * line->capacity);
+		line->starts = realloc(line->starts, sizeof(*line->starts) * line->capacity);
+	}
+	memmove(line->chunks + index + 1, line->chunks + index, sizeof(*line->chunks) * (line->num_chunks - index));
+	memmove(line->starts + index + 1, line->starts + index, sizeof(*line->starts) * (line->num_chunks - index));
+	line->chunks[index] = chunk;
+	line->num_chunks++;
+}
+
+static void remove_chunk(struct LongLine *line, size_t index) {
+	free_line(line->chunks[index]);
+	line->num_chunks--;
+	memmove(line->chunks + index, line->chunks + index + 1, sizeof(*line->chunks) * (line->num_chunks - index));
+	memmove(line->starts + index, line->starts + index + 1, sizeof(*line->starts) * (line->num_chunks - index));
+}
+
+/**
+ * Recomputes the positions of the chunks from index on.
+ */
+static void update_chunk_starts(struct LongLine *line, size_t index) {
+	for (size_t i = index; i < line->num_chunks; i++) {
+		line->starts[i] = i == 0 ? 0 : line->starts[i - 1] + line->chunks[i - 1]->length;
+	}
+}
+
+/**
+ * Turns a plain line which has reached LINE_CHUNK_SIZE into the first
+ * chunk of a long line. Its characters are not copied.
+ */
+static void promote_line(struct Line **lineptr) {
+	static const size_t default_capacity = 16;  /* num chunks */
+	size_t size;
+	struct LongLine *line = allocate_block(sizeof(*line), &size);
+	line->line.length = 0;
+	line->line.capacity = LONG_LINE_CAPACITY;
+	line->line.gap = 0;
+	line->line.generation = snapshot.generation;
+	line->length = (*lineptr)->length;
+	line->capacity = default_capacity;
+	line->chunks = malloc(sizeof(*line->chunks) * line->capacity);
+	line->starts = malloc(sizeof(*line->starts) * line->capacity);
+	line->chunks[0] = *lineptr;
+	line->starts[0] = 0;
+	line->num_chunks = 1;
+	*lineptr = &line->line;
+}
+
+/**
+ * Moves the upper half of a full chunk into a new chunk after it.
+ */
+static void split_chunk(struct LongLine *line, size_t index) {
+	struct Line *chunk = line->chunks[index];
+	struct Line *next = create_line();
+	append_line_text(&next, chunk, chunk->length / 2);
+	truncate_line(&line->chunks[index], chunk->length / 2);
+	insert_chunk(line, index + 1, next);
+	update_chunk_starts(line, index + 1);
+}
+
+static void insert_long_character(struct LongLine *line, size_t position, int ch) {
+	size_t i = find_chunk(line, position);
+	if (line->chunks[i]->length == LINE_CHUNK_SIZE) {
+		split_chunk(line, i);
+		if (position > line->starts[i + 1]) i++;
+	}
+	insert_character(&line->chunks[i], position - line->starts[i], ch);
+	line->length++;
+	for (size_t j = i + 1; j < line->num_chunks; j++) {
+		line->starts[j]++;
+	}
+}
+
+void insert_character(struct Line **lineptr, size_t position, int ch) {
+	assert (position <= length_of(*lineptr));
+	ensure_private_line(lineptr);
+	if (not line_is_long(*lineptr) and (*lineptr)->length == LINE_CHUNK_SIZE) {
+		promote_line(lineptr);
+	}
+	if (line_is_long(*lineptr)) {
+		insert_long_character((struct LongLine*)*lineptr, position, ch);
+		return;
+	}
+	reserve_line_capacity(lineptr, 1);
+	struct Line *line = *lineptr;
+	move_gap(line, position);
+	buffer_of(line)[line->gap++] = ch;
+	line->length++;
 }
 
 void append_character(struct Line **lineptr, int ch) {
-	insert_character(lineptr, (*lineptr)->length, ch);
+	insert_character(lineptr, length_of(*lineptr), ch);
 }
 
 void append_string(struct Line **lineptr, const char *text) {
-	while (*text) {
-		append_character(lineptr, *text++);
+	append_text(lineptr, text, strlen(text));
+}
+
+/**
+ * Fills up the last chunk, then appends new chunks holding the rest.
+ */
+static void append_long_text(struct LongLine *line, const char *text, size_t length) {
+	struct Line **last = &line->chunks[line->num_chunks - 1];
+	size_t n = min(length, LINE_CHUNK_SIZE - (*last)->length);
+	append_text(last, text, n);
+	line->length += n;
+	for (size_t i = n; i < length; i += n) {
+		n = min(length - i, LINE_CHUNK_SIZE);
+		insert_chunk(line, line->num_chunks, create_line_from_text(text + i, n));
+		line->starts[line->num_chunks - 1] = line->length;
+		line->length += n;
+	}
+}
+
+void append_text(struct Line **lineptr, const char *text, size_t length) {
+	ensure_private_line(lineptr);
+	if (not line_is_long(*lineptr) and (*lineptr)->length + length > LINE_CHUNK_SIZE) {
+		promote_line(lineptr);
+	}
+	if (line_is_long(*lineptr)) {
+		append_long_text((struct LongLine*)*lineptr, text, length);
+		return;
 	}
+	reserve_line_capacity(lineptr, length);
+	struct Line *line = *lineptr;
+	move_gap(line, line->length);
+	memcpy(buffer_of(line) + line->gap, text, length);
+	line->gap += length;
+	line->length += length;
+}
+
+void append_line_text(struct Line **lineptr, struct Line *source, size_t position) {
+	assert (*lineptr != source);
+	size_t length = length_of(source);
+	while (position < length) {
+		size_t n;
+		const char *text = segment_of(source, position, &n);
+		append_text(lineptr, text, n);
+		position += n;
+	}
+}
+
+/**
+ * Text that fits into the chunk at position goes into that chunk. Otherwise
+ * the chunk is cut at position and the text goes in between as new chunks.
+ */
+static void insert_long_text(struct LongLine *line, size_t position, const char *text, size_t length) {
+	size_t i = find_chunk(line, position);
+	size_t offset = position - line->starts[i];
+	struct Line **chunk = &line->chunks[i];
+	if ((*chunk)->length + length <= LINE_CHUNK_SIZE) {
+		insert_characters(chunk, offset, text, length);
+	} else {
+		struct Line *tail = create_line();
+		append_line_text(&tail, *chunk, offset);
+		truncate_line(chunk, offset);
+		size_t j = i + 1;
+		for (size_t k = 0; k < length; k += LINE_CHUNK_SIZE) {
+			insert_chunk(line, j++, create_line_from_text(text + k, min(length - k, LINE_CHUNK_SIZE)));
+		}
+		if (tail->length > 0) {
+			insert_chunk(line, j, tail);
+		} else {
+			free_line(tail);
+		}
+		if (line->chunks[i]->length == 0) {
+			remove_chunk(line, i);
+		}
+	}
+	line->length += length;
+	update_chunk_starts(line, i);
+}
+
+void insert_characters(struct Line **lineptr, size_t position, const char *text, size_t length) {
+	assert (position <= length_of(*lineptr));
+	ensure_private_line(lineptr);
+	if (not line_is_long(*lineptr) and (*lineptr)->length + length > LINE_CHUNK_SIZE) {
+		promote_line(lineptr);
+	}
+	if (line_is_long(*lineptr)) {
+		insert_long_text((struct LongLine*)*lineptr, position, text, length);
+		return;
+	}
+	reserve_line_capacity(lineptr, length);
+	struct Line *line = *lineptr;
+	move_gap(line, position);
+	memcpy(buffer_of(line) + line->gap, text, length);
+	line->gap += length;
+	line->length += length;
+}
+
+static void remove_long_character(struct LongLine *line, size_t position) {
+	size_t i = find_chunk(line, position);
+	remove_character(&line->chunks[i], position - line->starts[i]);
+	line->length--;
+	if (line->chunks[i]->length == 0 and line->num_chunks > 1) {
+		remove_chunk(line, i);
+	}
+	update_chunk_starts(line, i);
 }
 
 void remove_character(struct Line **lineptr, size_t position) {
-	assert ((*lineptr)->length > 0);
-	assert (position < (*lineptr)->length);
-	memmove(  /* Overwrite the character at position */
-		text_of(*lineptr) + position,
-		text_of(*lineptr) + position + 1,
-		(*lineptr)->length - position
-	);
-	(*lineptr)->length--;
-	/* Null-terminator automatically moves to new length in memmove */
+	assert (length_of(*lineptr) > 0);
+	assert (position < length_of(*lineptr));
+	ensure_private_line(lineptr);
+	if (line_is_long(*lineptr)) {
+		remove_long_character((struct LongLine*)*lineptr, position);
+		return;
+	}
+	move_gap(*lineptr, position);
+	(*lineptr)->length--;  /* The character after the gap joins the gap */
 }
 
-struct Line* read_line_from_file(FILE *fp) {
-	struct Line *line = create_line();
-	int ch;
-	for (ch = fgetc(fp); ch != '\n' and ch != EOF; ch = fgetc(fp)) {
-		append_character(&line, ch);
+static void remove_long_text(struct LongLine *line, size_t position, size_t n) {
+	size_t first = find_chunk(line, position);
+	size_t offset = position - line->starts[first];
+	line->length -= n;
+	for (size_t i = first; n > 0; offset = 0) {
+		size_t count = min(n, line->chunks[i]->length - offset);
+		if (count == line->chunks[i]->length and line->num_chunks > 1) {
+			remove_chunk(line, i);
+		} else {
+			remove_characters(&line->chunks[i++], offset, count);
+		}
+		n -= count;
 	}
-	return line;
-}
\ No newline at end of file
+	update_chunk_starts(line, first);
+}
+
+void remove_characters(struct Line **lineptr, size_t position, size_t n) {
+	assert (position + n <= length_of(*lineptr));
+	ensure_private_line(lineptr);
+	if (line_is_long(*lineptr)) {
+		remove_long_text((struct LongLine*)*lineptr, position, n);
+		return;
+	}
+	move_gap(*lineptr, position);
+	(*lineptr)->length -= n;  /* The characters after the gap join the gap */
+}
+
+static void truncate_long_line(struct LongLine *line, size_t length) {
+	size_t i = find_chunk(line, length);
+	truncate_line(&line->chunks[i], length - line->starts[i]);
+	while (line->num_chunks > i + 1) {
+		remove_chunk(line, line->num_chunks - 1);
+	}
+	if (line->chunks[i]->length == 0 and i > 0) {
+		remove_chunk(line, i);
+	}
+	line->length = length;
+}
+
+void truncate_line(struct Line **lineptr, size_t length) {
+	assert (length <= length_of(*lineptr));
+	ensure_private_line(lineptr);
+	struct Line *line = *lineptr;
+	if (line_is_long(line)) {
+		truncate_long_line((struct LongLine*)line, length);
+		return;
+	}
+	if (length < line->gap) {
+		line->gap = length;
+	} else {
+		move_gap(line, length);
+	}
+	line->length = length;
+}
@@ -10,7 +10,9 @@ int main(int argc, char *argv[]) {
 	parse_arguments(argc, argv);
 	initialize_clide();
 	open_document_editor();
-	while (handle_input(getch()));
+	do {
+		render_editor();
+	} while (handle_pending_input());
 	close_document_editor();
 	quit_clide();
 	return EXIT_SUCCESS;
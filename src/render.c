@@ -0,0 +1,238 @@
+#include "clide.h"
+
+/**
+ * Parts of the screen that are out of date. Lines are document line
+ * numbers (normalized), so that damage recorded before scrolling still
+ * refers to the right text.
+ */
+struct Damage {
+	bool is_screen_damaged;
+	bool is_page_damaged;
+	bool is_title_bar_damaged;
+	bool is_status_bar_damaged;
+	size_t first_line, end_line;  /* first_line == end_line if none */
+};
+
+static struct Damage damage;
+
+/* Shown in the status bar until the next input */
+static char status_message[128];
+
+void mark_screen_damaged(void) {
+	damage.is_screen_damaged = true;
+}
+
+void mark_page_damaged(void) {
+	damage.is_page_damaged = true;
+}
+
+void mark_lines_damaged(size_t first, size_t end) {
+	if (first >= end) return;
+	if (damage.first_line == damage.end_line) {
+		damage.first_line = first;
+		damage.end_line = end;
+	} else {
+		damage.first_line = min(damage.first_line, first);
+		damage.end_line = max(damage.end_line, end);
+	}
+}
+
+void mark_line_damaged(size_t index) {
+	mark_lines_damaged(index, index + 1);
+}
+
+void mark_title_bar_damaged(void) {
+	damage.is_title_bar_damaged = true;
+}
+
+void mark_status_bar_damaged(void) {
+	damage.is_status_bar_damaged = true;
+}
+
+void show_status_message(const char *format, ...) {
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(status_message, sizeof(status_message), format, arguments);
+	va_end(arguments);
+	damage.is_status_bar_damaged = true;
+}
+
+void clear_status_message(void) {
+	if (status_message[0] != '\0') {
+		status_message[0] = '\0';
+		damage.is_status_bar_damaged = true;
+	}
+}
+
+static void draw_title_bar(void) {
+	move(window.y, window.x);
+	clrtoeol();
+	chgat(-1, A_REVERSE, 10, NULL);
+	attron(A_REVERSE | A_BOLD);
+	printw("\tclide %s\t", CLIDE_VERSION);
+	attroff(A_BOLD);
+	printw("File %s%c", editor.document->path, editor.was_modified ? '*' : ' ');
+	attroff(A_REVERSE);
+}
+
+static void draw_status_bar(void) {
+	move(window.height - 1, window.x);
+	clrtoeol();
+	chgat(-1, A_REVERSE, 10, NULL);
+	attron(A_REVERSE);
+	bool is_indexing = editor.document->stream != NULL and not editor.document->stream->is_complete;
+	printw("  ");
+	if (status_message[0] != '\0') {  /* First, so that narrow terminals show it */
+		printw("%s | ", status_message);
+	}
+	printw(
+		"Term %dx%d | Ln %zu/%zu%s | Col %zu/%zu | Off %zu,%zu",
+		window.width, window.height,
+		editor.line, editor.document->num_lines, is_indexing ? "+" : "",
+		editor.column, length_of(current_line()) + 1,
+		editor.line_offset, editor.column_offset
+	);
+	size_t offset = offset_of_line(editor.document, normalize(editor.line)) + normalize(editor.column);
+	size_t size = size_of_document(editor.document);
+	printw(
+		" | Byte %zu/%zu%s %zu%%",
+		offset, size, is_indexing ? "+" : "",
+		size > 0 ? offset * 100 / size : 100
+	);
+	size_t number;
+	size_t num_matches = count_matches(normalize(editor.line), normalize(editor.column), &number);
+	const char *more = is_indexing_matches() ? "+" : "";
+	if (number > 0) {
+		printw(" | Match %zu/%zu%s", number, num_matches, more);
+	} else if (num_matches > 0 or is_indexing_matches()) {
+		printw(" | %zu%s matches", num_matches, more);
+	}
+	if (editor.document->save != NULL) {
+		printw(" | Saving");
+	}
+	attroff(A_REVERSE);
+}
+
+/**
+ * Draws the character of a line from position to next, which is drawn at
+ * *column, on the screen from curx on and returns the screen x after it.
+ * Only the cells from editor.column_offset on are drawn. Tabs become
+ * spaces, control characters their caret letter in reverse and invalid
+ * UTF-8 U+FFFD.
+ */
+static int draw_character(struct Line *line, size_t position, size_t next, size_t *column, int curx) {
+	static const char replacement[] = "\xEF\xBF\xBD";
+	size_t n;
+	uint32_t codepoint = codepoint_at(line, position, &n);
+	size_t end = codepoint == '\t' ?
+		*column + config.tabsize - *column % config.tabsize :
+		*column + max(character_width(codepoint), 1);
+	if (*column < editor.column_offset or curx + (end - *column) > (size_t)editor.width or codepoint == '\t') {
+		for (; *column < end; ++*column) {  /* Cut off at the edges, or a tab */
+			if (*column >= editor.column_offset and curx < editor.width) {
+				addch(' ');
+				curx++;
+			}
+		}
+		return curx;
+	}
+	char text[32];  /* Marks beyond are not drawn */
+	size_t length = 0;
+	if (codepoint < 0x20 or codepoint == 0x7F) {
+		addch((codepoint == 0x7F ? '?' : '@' + codepoint) | A_REVERSE);
+	} else if (codepoint < 0x80) {
+		addch(codepoint);
+	} else if (codepoint == 0xFFFD and n == 1) {
+		addstr(replacement);
+	} else {
+		if (character_width(codepoint) == 0) {  /* Nothing to draw it on */
+			text[length++] = ' ';
+		}
+		for (size_t m; length < sizeof(text) and position < next; position += m) {
+			const char *segment = segment_of(line, position, &m);
+			m = min(min(m, next - position), sizeof(text) - length);
+			memcpy(text + length, segment, m);
+			length += m;
+		}
+		addnstr(text, length);
+	}
+	curx += end - *column;
+	*column = end;
+	return curx;
+}
+
+/**
+ * Draws the screen row of a line, or clears it if the row lies past the
+ * end of the document. Tabs are expanded to the next tab stop, tokens are
+ * drawn in the attributes of their kind and matches of the search are
+ * highlighted. Characters are stepped over as a whole.
+ */
+static void draw_line(size_t index) {
+	move(index - editor.line_offset + editor.y, editor.x);
+	clrtoeol();
+	if (index >= editor.document->num_lines) return;
+	size_t num_runs, run = 0;
+	const struct TokenRun *runs = highlight_line(index, &num_runs);
+	struct Line *line = *line_at(index);
+	size_t length = length_of(line);
+	size_t first = position_at_screen_column(index, editor.column_offset);
+	size_t column = screen_column_of(index, first);  /* Before the offset if a tab straddles it */
+	size_t visible_end = min(length, position_at_screen_column(index, editor.column_offset + editor.width - editor.x) + 1);
+	size_t match_start, match_end = 0;
+	bool has_match = find_line_match(index, line, first, visible_end, &match_start, &match_end);
+	int curx = editor.x;
+	for (size_t i = first, next; i < length and curx < editor.width; i = next) {
+		next = next_character(line, i);
+		if (has_match and i >= match_end) {
+			has_match = find_line_match(index, line, i, visible_end, &match_start, &match_end);
+		}
+		while (run + 1 < num_runs and runs[run + 1].column <= i) run++;
+		attrset(token_attribute(runs[run].kind));
+		if (active_selection()) highlight_selection(index, i);
+		if (has_match and i >= match_start) {
+			attron(A_BOLD | A_UNDERLINE);
+		} else {
+			attroff(A_BOLD | A_UNDERLINE);
+		}
+		curx = draw_character(line, i, next, &column, curx);
+	}
+	attrset(token_attribute(TOKEN_TEXT));
+}
+
+static void draw_lines(size_t first, size_t end) {
+	first = max(first, editor.line_offset);
+	end = min(end, editor.line_offset + editor.height);
+	for (size_t i = first; i < end; i++) {
+		draw_line(i);
+	}
+}
+
+/**
+ * Brings the screen up to date with a single flush. Curses compares the
+ * result with what the terminal shows and only sends the difference.
+ */
+void render_editor(void) {
+	update_highlight();
+	if (damage.is_screen_damaged) {
+		erase();
+		damage.is_title_bar_damaged = true;
+		damage.is_page_damaged = true;
+		damage.is_status_bar_damaged = true;
+	}
+	if (damage.is_title_bar_damaged) {
+		draw_title_bar();
+	}
+	if (damage.is_page_damaged) {
+		draw_lines(editor.line_offset, editor.line_offset + editor.height);
+	} else {
+		draw_lines(damage.first_line, damage.end_line);
+	}
+	if (damage.is_status_bar_damaged) {
+		draw_status_bar();
+	}
+	update_cursor(normalize(editor.line), normalize(editor.column));
+	move(cursor.y, cursor.x);
+	wnoutrefresh(stdscr);
+	doupdate();
+	memset(&damage, 0, sizeof(damage));
+}
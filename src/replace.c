@@ -0,0 +1,146 @@
+#include "clide.h"
+
+/**
+ * A line being rebuilt with the replacements that touch it. Workers build
+ * the new text, the main thread then creates the line from it, since the
+ * block allocator is not thread-safe.
+ */
+struct RebuiltLine {
+	struct Line **slot;  /* within its page, which edit_line pinned */
+	const struct Replacement *replacements;
+	size_t num_replacements;
+	const char *text;
+	size_t length;
+};
+
+/**
+ * Consecutive lines of a batch that one worker builds the new text of,
+ * into a single buffer.
+ */
+struct ReplaceTask {
+	struct RebuiltLine *lines;
+	size_t num_lines;
+	char *buffer;
+};
+
+/**
+ * Lines rebuilt per batch. The new text of a batch is held in memory at
+ * once, and the pages of its lines must be resident at once.
+ */
+static const size_t batch_lines = 1 << 14;
+
+/**
+ * Lines a worker gets at least. Smaller batches are not worth a thread.
+ */
+static const size_t lines_per_task = 1024;
+
+static char* copy_characters(struct Line *line, size_t position, size_t n, char *out) {
+	for (size_t m; n > 0; position += m, n -= m) {
+		const char *segment = segment_of(line, position, &m);
+		m = min(m, n);
+		memcpy(out, segment, m);
+		out += m;
+	}
+	return out;
+}
+
+static size_t rebuilt_length(struct RebuiltLine *rebuilt) {
+	size_t length = length_of(*rebuilt->slot);
+	for (size_t i = 0; i < rebuilt->num_replacements; i++) {
+		length += rebuilt->replacements[i].text_length - rebuilt->replacements[i].length;
+	}
+	return length;
+}
+
+/**
+ * Builds the new text of the lines of a task, copying the text between
+ * the replacements segment by segment.
+ */
+static void* build_lines(void *argument) {
+	struct ReplaceTask *task = argument;
+	size_t size = 0;
+	for (size_t i = 0; i < task->num_lines; i++) {
+		task->lines[i].length = rebuilt_length(&task->lines[i]);
+		size += task->lines[i].length;
+	}
+	char *out = task->buffer = malloc(max(size, 1));
+	for (size_t i = 0; i < task->num_lines; i++) {
+		struct RebuiltLine *rebuilt = &task->lines[i];
+		struct Line *line = *rebuilt->slot;
+		size_t position = 0;
+		rebuilt->text = out;
+		for (size_t k = 0; k < rebuilt->num_replacements; k++) {
+			const struct Replacement *replacement = &rebuilt->replacements[k];
+			out = copy_characters(line, position, replacement->column - position, out);
+			memcpy(out, replacement->text, replacement->text_length);
+			out += replacement->text_length;
+			position = replacement->column + replacement->length;
+		}
+		out = copy_characters(line, position, length_of(line) - position, out);
+	}
+	return NULL;
+}
+
+/**
+ * Collects the lines touched by the replacements from *next on, up to
+ * batch_lines, and pins their pages so that they stay resident.
+ */
+static size_t collect_batch(
+	struct TextDocument *doc, const struct Replacement *replacements, size_t n,
+	size_t *next, struct RebuiltLine *lines
+) {
+	size_t num_lines = 0;
+	for (size_t i = *next; i < n and num_lines < batch_lines; num_lines++) {
+		struct RebuiltLine *rebuilt = &lines[num_lines];
+		rebuilt->slot = edit_line(doc, replacements[i].line);
+		rebuilt->replacements = &replacements[i];
+		rebuilt->num_replacements = 0;
+		do {
+			rebuilt->num_replacements++;
+			i++;
+		} while (i < n and replacements[i].line == rebuilt->replacements->line);
+		*next = i;
+	}
+	return num_lines;
+}
+
+/**
+ * Lines are replaced batch by batch: the main thread collects the lines,
+ * the workers build their new text in parallel and the main thread swaps
+ * in new lines of the final size.
+ */
+void replace_text(struct TextDocument *doc, const struct Replacement *replacements, size_t n) {
+	if (n == 0) return;
+	reindex_matches(doc, replacements[0].line);  /* Instead of line by line */
+	long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_workers = num_processors > 0 ? num_processors : 1;
+	struct RebuiltLine *lines = malloc(sizeof(*lines) * min(n, batch_lines));
+	struct ReplaceTask *tasks = malloc(sizeof(*tasks) * num_workers);
+	pthread_t *workers = malloc(sizeof(*workers) * num_workers);
+	for (size_t next = 0; next < n; ) {
+		size_t num_lines = collect_batch(doc, replacements, n, &next, lines);
+		size_t num_tasks = min(num_workers, (num_lines + lines_per_task - 1) / lines_per_task);
+		for (size_t i = 0; i < num_tasks; i++) {
+			tasks[i].lines = &lines[num_lines * i / num_tasks];
+			tasks[i].num_lines = num_lines * (i + 1) / num_tasks - num_lines * i / num_tasks;
+		}
+		for (size_t i = 1; i < num_tasks; i++) {
+			pthread_create(&workers[i], NULL, build_lines, &tasks[i]);
+		}
+		build_lines(&tasks[0]);
+		for (size_t i = 1; i < num_tasks; i++) {
+			pthread_join(workers[i], NULL);
+		}
+		for (size_t i = 0; i < num_lines; i++) {
+			struct Line *old = *lines[i].slot;
+			*lines[i].slot = create_line_from_text(lines[i].text, lines[i].length);
+			free_line(old);
+		}
+		for (size_t i = 0; i < num_tasks; i++) {
+			free(tasks[i].buffer);
+		}
+	}
+	free(workers);
+	free(tasks);
+	free(lines);
+}
@@ -0,0 +1,324 @@
+#include "clide.h"
+
+/**
+ * Output of a save. Lines are gathered into blocks of save_block_size,
+ * and segments of at least that size are written as they are.
+ */
+struct SaveBuffer {
+	int fd;
+	char *data;
+	size_t length;
+	off_t offset;  /* of the buffered data in the file */
+	int error;  /* errno of the first failed write */
+};
+
+static const size_t save_block_size = 1 << 20;
+
+static void flush_save_buffer(struct SaveBuffer *out) {
+	if (out->error == 0 and not write_fully(out->fd, out->data, out->length)) {
+		out->error = errno;
+	}
+	out->offset += out->length;
+	out->length = 0;
+}
+
+static void write_to_save_buffer(struct SaveBuffer *out, const char *text, size_t length) {
+	if (out->length + length > save_block_size) {
+		flush_save_buffer(out);
+	}
+	if (length >= save_block_size) {
+		if (out->error == 0 and not write_fully(out->fd, text, length)) {
+			out->error = errno;
+		}
+		out->offset += length;
+	} else {
+		memcpy(out->data + out->length, text, length);
+		out->length += length;
+	}
+}
+
+static void write_extent(struct DocumentSave *save, const struct PageExtent *extent, struct SaveBuffer *out) {
+	flush_save_buffer(out);
+	if (out->error == 0 and not copy_extent(save->source, extent, out->fd)) {
+		out->error = errno ? errno : EIO;
+	}
+	out->offset = lseek(out->fd, 0, SEEK_CUR);
+}
+
+/**
+ * Writes the lines of a page separated by newlines, without a newline
+ * after the last one. Pages of streamed documents that were not resident
+ * are copied from the file as they are.
+ */
+static void write_page(struct DocumentSave *save, struct PageSnapshot *page, struct SaveBuffer *out) {
+	if (page->lines == NULL) {
+		write_extent(save, &page->extent, out);
+		return;
+	}
+	for (size_t i = 0; i < page->num_lines; i++) {
+		struct Line *line = page->lines[i];
+		size_t length = length_of(line);
+		for (size_t position = 0, n; position < length; position += n) {
+			const char *text = segment_of(line, position, &n);
+			write_to_save_buffer(out, text, n);
+		}
+		if (i + 1 < page->num_lines) {
+			write_to_save_buffer(out, "\n", 1);
+		}
+	}
+}
+
+/**
+ * Takes the mode and owner of the saved file from the file it replaces,
+ * or uses the default mode for new files. Files with other hard links are
+ * overwritten in place, which keeps them shared, unless the document still
+ * reads from them: the pages of a streamed document are loaded from the
+ * file on demand, so it is replaced instead.
+ */
+static void inspect_target(struct TextDocument *doc, struct DocumentSave *save) {
+	struct stat info;
+	if (stat(save->path, &info) == 0) {
+		save->mode = info.st_mode & 07777;
+		save->owner = info.st_uid;
+		save->group = info.st_gid;
+		save->is_in_place = (
+			S_ISREG(info.st_mode) and info.st_nlink > 1 and
+			doc->stream == NULL and detach_document_mapping(doc)
+		);
+		return;
+	}
+	mode_t mask = umask(0);
+	umask(mask);
+	save->mode = 0666 & ~mask;
+	save->owner = (uid_t)-1;  /* Left as they are */
+	save->group = (gid_t)-1;
+}
+
+/**
+ * Makes the rename of the saved file durable. Not every file system
+ * supports this, so failures are ignored.
+ */
+static void sync_parent_directory(const char *path) {
+	char *directory = strdup(path);
+	char *slash = strrchr(directory, '/');
+	if (slash == NULL) {
+		strcpy(directory, ".");
+	} else {
+		slash[slash == directory] = '\0';  /* Keep the root */
+	}
+	int fd = open(directory, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(directory);
+}
+
+/**
+ * Copies the part of a streamed file that was not indexed when the save
+ * began as it is, once the indexer has found its end.
+ */
+static void write_rest_of_file(struct DocumentSave *save, struct SaveBuffer *out) {
+	save->rest.size = wait_for_stream_index(save->stream) - save->rest.offset;
+	save->rest.is_tail = true;
+	flush_save_buffer(out);
+	save->rest_offset = out->offset;
+	write_extent(save, &save->rest, out);
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * The snapshot is written to a temporary file next to the original, which
+ * is synced to disk and then replaces it with the owner and mode of the
+ * original. The original file stays intact while it is read from: streamed
+ * documents copy their unloaded pages from it and the line views of mapped
+ * documents keep referring to it, even after the replacement. Files with
+ * other hard links are overwritten and truncated instead, after the views
+ * were detached from them. Runs on the writer thread, which must not touch
+ * the document or allocate lines.
+ */
+static void* write_document_snapshot(void *argument) {
+	struct DocumentSave *save = argument;
+	static const char suffix[] = ".XXXXXX";
+	char *temporary = NULL;
+	int fd;
+	if (save->is_in_place) {
+		fd = open(save->path, O_WRONLY);
+	} else {
+		temporary = malloc(strlen(save->path) + sizeof(suffix));
+		strcpy(temporary, save->path);
+		strcat(temporary, suffix);
+		fd = mkstemp(temporary);
+	}
+	struct SaveBuffer out = {fd, NULL, 0, 0, 0};
+	if (out.fd < 0) {
+		out.error = errno;
+	} else {
+		out.data = malloc(save_block_size);
+		for (size_t i = 0; out.error == 0 and i < save->num_pages; i++) {
+			save->extents[i].offset = out.offset + out.length;
+			write_page(save, &save->pages[i], &out);
+			if (i + 1 < save->num_pages or save->stream != NULL) {
+				write_to_save_buffer(&out, "\n", 1);
+			}
+			save->extents[i].size = out.offset + out.length - save->extents[i].offset;
+		}
+		if (out.error == 0 and save->stream != NULL) {
+			write_rest_of_file(save, &out);
+		}
+		flush_save_buffer(&out);
+		free(out.data);
+		if (temporary != NULL) {
+			fchown(out.fd, save->owner, save->group);  /* Not permitted to every user */
+			fchmod(out.fd, save->mode);  /* After the owner, which clears set-user-ID */
+		} else if (out.error == 0 and ftruncate(out.fd, out.offset) != 0) {
+			out.error = errno;
+		}
+		if (out.error == 0 and fsync(out.fd) != 0) {
+			out.error = errno;
+		}
+		if (close(out.fd) != 0 and out.error == 0) {
+			out.error = errno;
+		}
+		if (temporary != NULL) {
+			if (out.error == 0 and rename(temporary, save->path) != 0) {
+				out.error = errno;
+			}
+			if (out.error == 0) {
+				sync_parent_directory(save->path);
+			} else {
+				unlink(temporary);
+			}
+		}
+	}
+	free(temporary);
+	pthread_mutex_lock(&save->lock);
+	save->report.size = out.offset;
+	save->report.seconds = elapsed_seconds(&save->start);
+	save->report.error = out.error;
+	save->is_finished = true;
+	pthread_mutex_unlock(&save->lock);
+	return NULL;
+}
+
+/**
+ * Copies the line pointers of resident pages, which freezes their lines,
+ * and the file extents of the others.
+ */
+static void take_snapshot(struct TextDocument *doc, struct DocumentSave *save) {
+	if (not begin_line_snapshot()) {  /* Generations wrapped around */
+		for (struct LinePage *page = doc->first_page; page != NULL; page = page->next) {
+			for (size_t i = 0; page->lines != NULL and i < page->num_lines; i++) {
+				age_line(page->lines[i]);
+			}
+		}
+	}
+	save->pages = malloc(sizeof(*save->pages) * doc->num_pages);
+	save->num_pages = 0;
+	for (struct LinePage *page = doc->first_page; page != NULL; page = page->next) {
+		struct PageSnapshot *snapshot = &save->pages[save->num_pages++];
+		snapshot->num_lines = page->num_lines;
+		snapshot->lines = NULL;
+		if (page->lines != NULL) {
+			snapshot->lines = malloc(sizeof(*snapshot->lines) * page->num_lines);
+			memcpy(snapshot->lines, page->lines, sizeof(*snapshot->lines) * page->num_lines);
+		}
+		snapshot->extent.offset = page->offset;
+		snapshot->extent.size = page->size;
+		snapshot->extent.num_lines = page->num_lines;
+		snapshot->extent.is_tail = page->is_tail;
+	}
+	save->version = doc->version;
+}
+
+void begin_document_save(struct TextDocument *doc) {
+	assert (doc->save == NULL);
+	struct DocumentSave *save = calloc(1, sizeof(*save));
+	clock_gettime(CLOCK_MONOTONIC, &save->start);
+	if (doc->stream != NULL) {
+		save->source = doc->stream->fd;
+		if (update_document_stream(doc)) {  /* The writer copies the rest */
+			save->stream = doc->stream;
+			save->rest.offset = doc->stream->adopted_size;
+		}
+	}
+	take_snapshot(doc, save);
+	save->path = realpath(doc->path, NULL);
+	if (save->path == NULL) {  /* A new file */
+		save->path = strdup(doc->path);
+	}
+	inspect_target(doc, save);
+	save->extents = malloc(sizeof(*save->extents) * save->num_pages);
+	pthread_mutex_init(&save->lock, NULL);
+	doc->save = save;
+	pthread_create(&save->writer, NULL, write_document_snapshot, save);
+}
+
+/**
+ * If the document is still as it was saved, unloaded pages of a streamed
+ * document are read from the new file from now on. Otherwise the page
+ * offsets no longer match and the stream keeps reading the old file,
+ * which remains accessible through the open descriptor. Pages indexed
+ * during the save lie in the copied rest of the file, which the writer
+ * only finished after the indexer, so joining it does not block.
+ */
+static void end_document_save(struct TextDocument *doc, struct SaveReport *report) {
+	struct DocumentSave *save = doc->save;
+	pthread_join(save->writer, NULL);
+	pthread_mutex_destroy(&save->lock);
+	end_line_snapshot();
+	*report = save->report;
+	report->has_later_edits = doc->version != save->version;
+	if (report->error == 0 and not report->has_later_edits and doc->stream != NULL) {
+		if (save->stream != NULL) {
+			finish_document_stream(doc);
+		}
+		size_t i = 0;
+		for (struct LinePage *page = doc->first_page; page != NULL; page = page->next, i++) {
+			if (i < save->num_pages) {
+				page->offset = save->extents[i].offset;
+				page->size = save->extents[i].size;
+			} else {
+				page->offset += save->rest_offset - save->rest.offset;
+			}
+			page->is_tail = page->next == NULL;
+		}
+		reopen_document_stream(doc);
+	}
+	for (size_t i = 0; i < save->num_pages; i++) {
+		free(save->pages[i].lines);
+	}
+	free(save->pages);
+	free(save->extents);
+	free(save->path);
+	free(save);
+	doc->save = NULL;
+}
+
+bool update_document_save(struct TextDocument *doc, struct SaveReport *report) {
+	if (doc->save == NULL) return false;
+	pthread_mutex_lock(&doc->save->lock);
+	bool is_finished = doc->save->is_finished;
+	pthread_mutex_unlock(&doc->save->lock);
+	if (is_finished) {
+		end_document_save(doc, report);
+	}
+	return is_finished;
+}
+
+void finish_document_save(struct TextDocument *doc, struct SaveReport *report) {
+	if (doc->save != NULL) {
+		end_document_save(doc, report);
+	}
+}
+
+bool save_document(struct TextDocument *doc, struct SaveReport *report) {
+	begin_document_save(doc);
+	finish_document_save(doc, report);
+	return report->error == 0;
+}
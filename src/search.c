@@ -0,0 +1,1038 @@
+#include "clide.h"
+
+/**
+ * State of a thread scanning lines for the pattern. regexec serializes
+ * threads sharing a compiled pattern, so every worker compiles its own.
+ */
+struct Scanner {
+	size_t anchor;  /* index of the rarest character of the literal */
+	char *scratch;  /* copy of lines that are not contiguous */
+	size_t scratch_capacity;
+	regex_t regex;  /* of workers */
+	size_t generation;  /* of the pattern the regex was compiled from */
+};
+
+/**
+ * A compiled regular expression, kept for when the same pattern is
+ * searched for again, e.g. after deleting a character while typing.
+ */
+struct CachedRegex {
+	char pattern[SEARCH_PATTERN_SIZE];
+	size_t length;
+	regex_t regex;
+	bool is_compiled;  /* the pattern is valid */
+	size_t last_use;
+};
+
+/**
+ * Number of compiled patterns kept by the main thread.
+ */
+#define REGEX_CACHE_SIZE 16
+
+static struct CachedRegex regex_cache[REGEX_CACHE_SIZE];
+static size_t num_regex_uses;
+
+/**
+ * The text being searched for while it is typed. matches[i] holds the
+ * first match of the first i+1 characters of the pattern after the origin,
+ * so typing another character continues from the last match and deleting
+ * one goes back to the previous match without scanning again.
+ */
+struct Search {
+	char pattern[SEARCH_PATTERN_SIZE];
+	size_t length;
+	bool is_regex;
+	bool is_valid;  /* there is a pattern and it compiled */
+	size_t generation;  /* counts pattern changes */
+	regex_t *regex;  /* of the main thread, within the cache */
+	char literal[SEARCH_PATTERN_SIZE];  /* every match contains */
+	size_t literal_length;
+	size_t anchor;  /* guessed from the literal alone */
+	struct SearchMatch matches[SEARCH_PATTERN_SIZE];
+	size_t origin_line, origin_column;
+	struct Scanner scanner;  /* of the main thread */
+};
+
+static struct Search search;
+
+/* Failed comparisons after which the anchor may be picked again */
+static const size_t anchor_misses = 256;
+
+/**
+ * Lines to scan again, because they were edited after being indexed.
+ */
+struct LineRange {
+	size_t first, end;
+};
+
+/**
+ * All matches of the pattern in the document of the editor, sorted by
+ * position. The document is scanned by the search pool in the background
+ * and the index is filled in batch by batch, from the first line on.
+ * Edits remove the matches of the lines they touch and shift those after,
+ * the touched lines are scanned again before the index is used.
+ */
+struct MatchIndex {
+	struct IndexedMatch *matches;
+	size_t num_matches;
+	size_t capacity;
+	size_t next_line;  /* lines before have been scanned */
+	struct LineRange *dirty;  /* sorted, disjoint */
+	size_t num_dirty;
+	size_t dirty_capacity;
+};
+
+static struct MatchIndex match_index;
+
+/**
+ * Lines of a page handed to a worker of the search pool, which collects
+ * the matches within them.
+ */
+struct SearchTask {
+	struct Line **lines;
+	size_t first_line;
+	size_t num_lines;
+	struct IndexedMatch *matches;
+	size_t num_matches;
+	size_t capacity;
+};
+
+/**
+ * Worker threads scanning the pages of a batch in parallel. The main
+ * thread waits for the batch to finish, so the document does not change
+ * while it is read.
+ */
+struct SearchPool {
+	pthread_t *workers;
+	size_t num_workers;
+	pthread_mutex_t lock;
+	pthread_cond_t has_tasks;
+	pthread_cond_t is_done;
+	struct SearchTask *tasks;  /* (locked) */
+	size_t num_tasks;  /* (locked) */
+	size_t next_task;  /* (locked) */
+	size_t num_finished;  /* (locked) */
+	bool is_stopping;  /* (locked) */
+};
+
+static struct SearchPool pool;
+
+/**
+ * Number of pages scanned per batch. Streamed documents keep fewer pages
+ * in memory, and all pages of a batch must be resident at once. Every
+ * page of a batch is loaded or marked as recently used when it is added,
+ * so with half the limit the pages loaded later never evict it.
+ */
+static const size_t batch_pages = 256;
+static const size_t streamed_batch_pages = MAX_RESIDENT_PAGES / 2;
+
+/**
+ * Time spent indexing before input is looked at again.
+ */
+static const double index_time_slice = 0.02;
+
+/**
+ * Ranks a character by how common it is in source code and prose.
+ * Anything not listed is assumed to be rare.
+ */
+static size_t frequency_of(char ch) {
+	static const char common[] = " etaoinsrlhdcu\tmpfgybw_.,()=;vkx";
+	const char *position = strchr(common, ch);
+	return ch == '\0' or position == NULL ? 0 : sizeof(common) - (position - common);
+}
+
+static void find_anchor(void) {
+	search.anchor = 0;
+	for (size_t i = 1; i < search.literal_length; i++) {
+		if (frequency_of(search.literal[i]) < frequency_of(search.literal[search.anchor])) {
+			search.anchor = i;
+		}
+	}
+	search.scanner.anchor = search.anchor;
+}
+
+/**
+ * Picks the character of the pattern that is the rarest in a sample of
+ * the text, for when the guess of frequency_of turns out to be wrong.
+ */
+static void learn_anchor(struct Scanner *scanner, const char *sample, size_t length) {
+	size_t counts[UCHAR_MAX + 1] = {0};
+	for (size_t i = 0; i < length; i++) {
+		counts[(unsigned char)sample[i]]++;
+	}
+	for (size_t i = 0; i < search.literal_length; i++) {
+		if (counts[(unsigned char)search.literal[i]] < counts[(unsigned char)search.literal[scanner->anchor]]) {
+			scanner->anchor = i;
+		}
+	}
+}
+
+/**
+ * Returns the first occurrence of the literal in the text. The rarest
+ * character of the literal is looked for with memchr, which libc
+ * vectorizes, so candidates that need comparing are few and far between.
+ * If they are not, the anchor is picked again based on the text.
+ */
+static const char* find_literal(struct Scanner *scanner, const char *text, size_t length) {
+	if (length < search.literal_length) return NULL;
+	const char *end = text + length - search.literal_length + 1;  /* of candidates */
+	size_t misses = 0;
+	for (const char *start = text; start < end; start++) {
+		const char *p = memchr(start + scanner->anchor, search.literal[scanner->anchor], end - start);
+		if (p == NULL) break;
+		start = p - scanner->anchor;
+		if (memcmp(start, search.literal, search.literal_length) == 0) {
+			return start;
+		}
+		if (++misses == anchor_misses and start - text < anchor_misses * 16) {
+			learn_anchor(scanner, text, start - text);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the text of the line from position on, with at least length
+ * characters if the line has them. Most lines are contiguous, the others
+ * are copied.
+ */
+static const char* text_of(struct Scanner *scanner, struct Line *line, size_t position, size_t length) {
+	size_t n;
+	const char *text = segment_of(line, position, &n);
+	if (n >= length) {
+		return text;
+	}
+	if (length > scanner->scratch_capacity) {
+		scanner->scratch_capacity = max(length, 2 * scanner->scratch_capacity);
+		scanner->scratch = realloc(scanner->scratch, scanner->scratch_capacity);
+	}
+	for (size_t offset = 0; offset < length; offset += n) {
+		text = segment_of(line, position + offset, &n);
+		memcpy(scanner->scratch + offset, text, min(n, length - offset));
+	}
+	return scanner->scratch;
+}
+
+static regex_t* regex_of(struct Scanner *scanner) {
+	if (scanner == &search.scanner) {
+		return search.regex;
+	}
+	if (scanner->generation != search.generation) {
+		char pattern[SEARCH_PATTERN_SIZE + 1];
+		memcpy(pattern, search.pattern, search.length);
+		pattern[search.length] = '\0';
+		if (scanner->generation != 0) {
+			regfree(&scanner->regex);
+		}
+		regcomp(&scanner->regex, pattern, REG_EXTENDED | REG_NEWLINE);  /* Valid, see update_search */
+		scanner->generation = search.generation;
+	}
+	return &scanner->regex;
+}
+
+/**
+ * Runs the regex on the text from position from on and stores where the
+ * match starts and ends. The text is passed as it is, without copying.
+ */
+static bool execute_regex(struct Scanner *scanner, const char *text, size_t from, size_t length, size_t *start, size_t *end) {
+	int flags = from > 0 ? REG_NOTBOL : 0;
+	regmatch_t match[1];
+#ifdef REG_STARTEND
+	match[0].rm_so = from;
+	match[0].rm_eo = length;
+	if (regexec(regex_of(scanner), text, 1, match, flags | REG_STARTEND) != 0) return false;
+	*start = match[0].rm_so;
+	*end = match[0].rm_eo;
+#else  /* The text needs to be terminated */
+	char *copy = malloc(length - from + 1);
+	memcpy(copy, text + from, length - from);
+	copy[length - from] = '\0';
+	bool is_found = regexec(regex_of(scanner), copy, 1, match, flags) == 0;
+	free(copy);
+	if (not is_found) return false;
+	*start = from + match[0].rm_so;
+	*end = from + match[0].rm_eo;
+#endif
+	return true;
+}
+
+/**
+ * Finds the first match within the text of a line which starts in
+ * [from, to) and stores its column and length. Lines without the literal
+ * every match of a regex contains are skipped without running the regex.
+ */
+static bool find_in_text(
+	struct Scanner *scanner, const char *text, size_t line_length,
+	size_t from, size_t to, size_t *column, size_t *length
+) {
+	if (not search.is_regex) {
+		size_t end = min(line_length, max(to, to + search.length - 1));  /* avoid overflow */
+		const char *match = find_literal(scanner, text + from, end - from);
+		if (match == NULL) return false;
+		*column = match - text;
+		*length = search.length;
+		return true;
+	}
+	if (search.literal_length > 0 and find_literal(scanner, text + from, line_length - from) == NULL) {
+		return false;
+	}
+	size_t start, end;
+	if (not execute_regex(scanner, text, from, line_length, &start, &end) or start >= to) {
+		return false;
+	}
+	*column = start;
+	*length = end - start;
+	return true;
+}
+
+static bool find_in_line(
+	struct Scanner *scanner, struct Line *line,
+	size_t from, size_t to, size_t *column, size_t *length
+) {
+	size_t line_length = length_of(line);
+	if (not search.is_valid or from >= line_length) return false;
+	const char *text = text_of(scanner, line, 0, line_length);
+	return find_in_text(scanner, text, line_length, from, to, column, length);
+}
+
+/**
+ * Returns how many of the lines are views that follow each other in the
+ * mapping of the file, i.e. are only separated by newlines.
+ */
+static size_t count_adjacent_views(struct Line **lines, size_t n) {
+	size_t count = 0;
+	const char *end = NULL;
+	for (; count < n and lines[count]->capacity == 0; count++) {
+		struct LineView *view = (struct LineView*)lines[count];
+		if (end != NULL and view->text != end + 1) break;
+		end = view->text + view->length;
+	}
+	return count;
+}
+
+/**
+ * Returns the number of lines from the first one on that are scanned in
+ * one go, and zero if the first line is scanned on its own.
+ */
+static size_t count_views_to_scan(struct Line **lines, size_t n) {
+	if (search.literal_length == 0 or memchr(search.literal, '\n', search.literal_length) != NULL) return 0;
+	size_t count = count_adjacent_views(lines, n);
+	return count > 1 ? count : 0;
+}
+
+/**
+ * Finds the first match within adjacent views from the line at *index on
+ * by scanning the mapping they refer to for the literal in one go, which
+ * saves the work per line. Matches cannot span lines, since patterns hold
+ * no newlines and regexes are compiled with REG_NEWLINE.
+ */
+static bool find_in_views(
+	struct Scanner *scanner, struct Line **lines, size_t n,
+	size_t *index, size_t *column, size_t *length
+) {
+	struct LineView *last = (struct LineView*)lines[n - 1];
+	while (*index < n) {
+		struct LineView *view = (struct LineView*)lines[*index];
+		const char *match = find_literal(scanner, view->text, last->text + last->length - view->text);
+		if (match == NULL) return false;
+		while (view->text + view->length < match) {
+			view = (struct LineView*)lines[++*index];
+		}
+		if (not search.is_regex) {
+			*column = match - view->text;
+			*length = search.length;
+			return true;
+		}
+		if (find_in_line(scanner, &view->line, 0, SIZE_MAX, column, length)) {
+			return true;
+		}
+		++*index;  /* The literal is not part of a match */
+	}
+	return false;
+}
+
+/**
+ * Finds the first match from the start line and column up to, but
+ * excluding, the end line and column. Walks the pages instead of
+ * looking up every line in the page tree.
+ */
+static bool find_in_range(
+	size_t start_line, size_t start_column,
+	size_t end_line, size_t end_column,
+	struct SearchMatch *match
+) {
+	struct TextDocument *doc = editor.document;
+	end_line = min(end_line, doc->num_lines);
+	if (end_line == doc->num_lines) {
+		end_column = 0;
+	}
+	size_t first_line, index = 0, length;  /* of the match within adjacent views */
+	struct LinePage *page = find_page(doc, start_line, &first_line);
+	for (size_t i = start_line; i < end_line or (i == end_line and end_column > 0); page = page->next) {
+		if (page->lines == NULL) {
+			get_line(doc, first_line);  /* Pages the lines in */
+		}
+		while (i - first_line < page->num_lines and i <= end_line) {
+			struct Line **lines = &page->lines[i - first_line];
+			size_t from = i == start_line ? start_column : 0;
+			size_t to = i == end_line ? end_column : SIZE_MAX;
+			size_t n = 0;
+			if (from == 0) {  /* Whole lines only */
+				n = count_views_to_scan(lines, min(first_line + page->num_lines, end_line) - i);
+			}
+			index = 0;
+			if (n > 0) {
+				if (find_in_views(&search.scanner, lines, n, &index, &match->column, &length)) break;
+				i += n;
+			} else if (find_in_line(&search.scanner, *lines, from, to, &match->column, &length)) {
+				break;
+			} else {
+				i++;
+			}
+		}
+		if (i - first_line < page->num_lines and i <= end_line) {
+			match->line = i + index;
+			match->is_found = true;
+			return true;
+		}
+		first_line += page->num_lines;
+	}
+	match->is_found = false;
+	return false;
+}
+
+/**
+ * Finds the first match from the given position on, wrapping around
+ * at the end of the document up to the origin of the search.
+ */
+static bool find_from(size_t line, size_t column, struct SearchMatch *match) {
+	if (line < search.origin_line or (line == search.origin_line and column < search.origin_column)) {
+		return find_in_range(line, column, search.origin_line, search.origin_column, match);
+	}
+	return (
+		find_in_range(line, column, SIZE_MAX, 0, match) or
+		find_in_range(0, 0, search.origin_line, search.origin_column, match)
+	);
+}
+
+static void add_task_match(struct SearchTask *task, size_t line, size_t column, size_t length) {
+	if (task->num_matches >= task->capacity) {
+		task->capacity = task->capacity ? 2 * task->capacity : 16;
+		task->matches = realloc(task->matches, sizeof(*task->matches) * task->capacity);
+	}
+	struct IndexedMatch *match = &task->matches[task->num_matches++];
+	match->line = line;
+	match->column = column;
+	match->length = length;
+}
+
+/**
+ * Collects the matches of a line from position from on. A line that is
+ * not contiguous is copied once for all of them.
+ */
+static void scan_rest_of_line(struct Scanner *scanner, struct SearchTask *task, size_t index, size_t from) {
+	struct Line *line = task->lines[index];
+	size_t line_length = length_of(line), column, length;
+	if (from >= line_length) return;
+	const char *text = text_of(scanner, line, 0, line_length);
+	while (from < line_length and find_in_text(scanner, text, line_length, from, SIZE_MAX, &column, &length)) {
+		add_task_match(task, task->first_line + index, column, length);
+		from = column + max(length, 1);
+	}
+}
+
+/**
+ * Collects all matches within the lines of a task. Matches do not overlap.
+ */
+static void scan_task(struct Scanner *scanner, struct SearchTask *task) {
+	for (size_t i = 0; i < task->num_lines; ) {
+		size_t n = count_views_to_scan(&task->lines[i], task->num_lines - i);
+		if (n == 0) {
+			scan_rest_of_line(scanner, task, i++, 0);
+			continue;
+		}
+		size_t index = i, column, length;
+		while (find_in_views(scanner, task->lines, i + n, &index, &column, &length)) {
+			add_task_match(task, task->first_line + index, column, length);
+			scan_rest_of_line(scanner, task, index++, column + max(length, 1));
+		}
+		i += n;
+	}
+}
+
+static void* run_search_worker(void *argument) {
+	struct Scanner scanner;
+	memset(&scanner, 0, sizeof(scanner));
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.next_task >= pool.num_tasks and not pool.is_stopping) {
+			pthread_cond_wait(&pool.has_tasks, &pool.lock);
+		}
+		if (pool.is_stopping) break;
+		struct SearchTask *task = &pool.tasks[pool.next_task++];
+		pthread_mutex_unlock(&pool.lock);
+		scanner.anchor = search.anchor;
+		scan_task(&scanner, task);
+		pthread_mutex_lock(&pool.lock);
+		if (++pool.num_finished == pool.num_tasks) {
+			pthread_cond_signal(&pool.is_done);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	if (scanner.generation != 0) {
+		regfree(&scanner.regex);
+	}
+	free(scanner.scratch);
+	return NULL;
+}
+
+static void start_search_pool(void) {
+	long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.num_workers = num_processors > 0 ? num_processors : 1;
+	pool.workers = malloc(sizeof(*pool.workers) * pool.num_workers);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.has_tasks, NULL);
+	pthread_cond_init(&pool.is_done, NULL);
+	for (size_t i = 0; i < pool.num_workers; i++) {
+		pthread_create(&pool.workers[i], NULL, run_search_worker, NULL);
+	}
+}
+
+static void stop_search_pool(void) {
+	if (pool.workers == NULL) return;
+	pthread_mutex_lock(&pool.lock);
+	pool.is_stopping = true;
+	pthread_cond_broadcast(&pool.has_tasks);
+	pthread_mutex_unlock(&pool.lock);
+	for (size_t i = 0; i < pool.num_workers; i++) {
+		pthread_join(pool.workers[i], NULL);
+	}
+	pthread_cond_destroy(&pool.is_done);
+	pthread_cond_destroy(&pool.has_tasks);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.workers);
+	memset(&pool, 0, sizeof(pool));
+}
+
+/**
+ * Scans the tasks on the workers and waits until all are done.
+ */
+static void run_search_tasks(struct SearchTask *tasks, size_t n) {
+	if (pool.workers == NULL) {
+		start_search_pool();
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.tasks = tasks;
+	pool.num_tasks = n;
+	pool.next_task = 0;
+	pool.num_finished = 0;
+	pthread_cond_broadcast(&pool.has_tasks);
+	while (pool.num_finished < pool.num_tasks) {
+		pthread_cond_wait(&pool.is_done, &pool.lock);
+	}
+	pool.tasks = NULL;
+	pool.num_tasks = 0;
+	pool.next_task = 0;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void reserve_matches(size_t n) {
+	if (match_index.num_matches + n > match_index.capacity) {
+		match_index.capacity = max(match_index.num_matches + n, 2 * match_index.capacity);
+		match_index.matches = realloc(match_index.matches, sizeof(*match_index.matches) * match_index.capacity);
+	}
+}
+
+/**
+ * Returns the position of the first indexed match at or after the given
+ * line and column.
+ */
+static size_t lower_bound(size_t line, size_t column) {
+	size_t first = 0, end = match_index.num_matches;
+	while (first < end) {
+		size_t middle = first + (end - first) / 2;
+		struct IndexedMatch *match = &match_index.matches[middle];
+		if (match->line < line or (match->line == line and match->column < column)) {
+			first = middle + 1;
+		} else {
+			end = middle;
+		}
+	}
+	return first;
+}
+
+/**
+ * Scans the next batch of pages and appends their matches to the index.
+ */
+static void index_next_batch(void) {
+	struct TextDocument *doc = editor.document;
+	size_t limit = doc->stream != NULL ? streamed_batch_pages : batch_pages;
+	struct SearchTask *tasks = calloc(limit, sizeof(*tasks));
+	size_t num_tasks = 0, first_line;
+	struct LinePage *page = find_page(doc, match_index.next_line, &first_line);
+	for (; page != NULL and num_tasks < limit; page = page->next) {
+		get_line(doc, first_line);  /* Pages the lines in, or touches them */
+		struct SearchTask *task = &tasks[num_tasks++];
+		task->first_line = match_index.next_line;
+		task->lines = &page->lines[match_index.next_line - first_line];
+		task->num_lines = page->num_lines - (match_index.next_line - first_line);
+		first_line += page->num_lines;
+		match_index.next_line = first_line;
+	}
+	run_search_tasks(tasks, num_tasks);
+	for (size_t i = 0; i < num_tasks; i++) {
+		reserve_matches(tasks[i].num_matches);
+		memcpy(
+			&match_index.matches[match_index.num_matches], tasks[i].matches,
+			sizeof(*match_index.matches) * tasks[i].num_matches
+		);
+		match_index.num_matches += tasks[i].num_matches;
+		free(tasks[i].matches);
+	}
+	free(tasks);
+}
+
+/**
+ * Scans the lines that were edited since they were indexed and inserts
+ * their matches. These are few, so the main thread does it.
+ */
+static void index_dirty_lines(void) {
+	struct SearchTask task = {NULL, 0, 0, NULL, 0, 0};
+	for (size_t i = 0; i < match_index.num_dirty; i++) {
+		struct LineRange *range = &match_index.dirty[i];
+		for (size_t line = range->first; line < range->end; line++) {
+			task.first_line = line;
+			task.lines = get_line(editor.document, line);
+			task.num_lines = 1;
+			task.num_matches = 0;
+			scan_task(&search.scanner, &task);
+			size_t position = lower_bound(line, 0);
+			reserve_matches(task.num_matches);
+			memmove(
+				&match_index.matches[position + task.num_matches], &match_index.matches[position],
+				sizeof(*match_index.matches) * (match_index.num_matches - position)
+			);
+			memcpy(&match_index.matches[position], task.matches, sizeof(*task.matches) * task.num_matches);
+			match_index.num_matches += task.num_matches;
+		}
+	}
+	free(task.matches);
+	match_index.num_dirty = 0;
+}
+
+static void reset_match_index(void) {
+	match_index.num_matches = 0;
+	match_index.next_line = 0;
+	match_index.num_dirty = 0;
+}
+
+bool update_match_index(void) {
+	if (not search.is_valid) return false;
+	index_dirty_lines();
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (match_index.next_line < editor.document->num_lines) {
+		index_next_batch();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9 > index_time_slice) break;
+	}
+	return is_indexing_matches();
+}
+
+bool is_indexing_matches(void) {
+	return search.is_valid and (
+		match_index.next_line < editor.document->num_lines or match_index.num_dirty > 0
+	);
+}
+
+const struct IndexedMatch* list_matches(size_t *n) {
+	while (update_match_index());
+	*n = search.is_valid ? match_index.num_matches : 0;
+	return match_index.matches;
+}
+
+size_t count_matches(size_t line, size_t column, size_t *number) {
+	*number = 0;
+	if (not search.is_valid) return 0;
+	index_dirty_lines();
+	size_t position = lower_bound(line, column);
+	if (
+		position < match_index.num_matches and
+		match_index.matches[position].line == line and
+		match_index.matches[position].column == column
+	) {
+		*number = position + 1;
+	}
+	return match_index.num_matches;
+}
+
+/**
+ * Adds edited lines to the ranges to scan again, merging ranges that
+ * overlap or touch.
+ */
+static void mark_lines_dirty(size_t first, size_t end) {
+	if (first >= end) return;
+	size_t i = 0;
+	while (i < match_index.num_dirty and match_index.dirty[i].end < first) i++;
+	if (i < match_index.num_dirty and match_index.dirty[i].first <= end) {
+		struct LineRange *range = &match_index.dirty[i];
+		range->first = min(range->first, first);
+		range->end = max(range->end, end);
+		while (i + 1 < match_index.num_dirty and range[1].first <= range->end) {
+			range->end = max(range->end, range[1].end);
+			memmove(&range[1], &range[2], sizeof(*range) * (match_index.num_dirty - i - 2));
+			match_index.num_dirty--;
+		}
+		return;
+	}
+	if (match_index.num_dirty >= match_index.dirty_capacity) {
+		match_index.dirty_capacity = match_index.dirty_capacity ? 2 * match_index.dirty_capacity : 8;
+		match_index.dirty = realloc(match_index.dirty, sizeof(*match_index.dirty) * match_index.dirty_capacity);
+	}
+	memmove(&match_index.dirty[i + 1], &match_index.dirty[i], sizeof(*match_index.dirty) * (match_index.num_dirty - i));
+	match_index.dirty[i].first = first;
+	match_index.dirty[i].end = end;
+	match_index.num_dirty++;
+}
+
+/**
+ * Shifts a line number past an edit. Lines within the edit map to its start.
+ */
+static size_t shift_line(size_t line, size_t first, size_t removed, size_t inserted) {
+	if (line >= first + removed) {
+		return line - removed + inserted;
+	}
+	return min(line, first);
+}
+
+void reindex_matches(struct TextDocument *doc, size_t line) {
+	if (doc != editor.document or not search.is_valid or line >= match_index.next_line) return;
+	match_index.num_matches = lower_bound(line, 0);
+	match_index.next_line = line;
+	while (match_index.num_dirty > 0 and match_index.dirty[match_index.num_dirty - 1].first >= line) {
+		match_index.num_dirty--;
+	}
+	if (match_index.num_dirty > 0) {
+		struct LineRange *last = &match_index.dirty[match_index.num_dirty - 1];
+		last->end = min(last->end, line);
+	}
+}
+
+void invalidate_matches(struct TextDocument *doc, size_t line, size_t removed, size_t inserted) {
+	if (doc != editor.document or not search.is_valid or line >= match_index.next_line) return;
+	if (line + removed > match_index.next_line) {  /* Scan from the edit on again */
+		reindex_matches(doc, line);
+		return;
+	}
+	size_t first = lower_bound(line, 0);
+	size_t end = lower_bound(line + removed, 0);
+	memmove(
+		&match_index.matches[first], &match_index.matches[end],
+		sizeof(*match_index.matches) * (match_index.num_matches - end)
+	);
+	match_index.num_matches -= end - first;
+	if (inserted != removed) {
+		for (size_t i = first; i < match_index.num_matches; i++) {
+			match_index.matches[i].line = match_index.matches[i].line - removed + inserted;
+		}
+		match_index.next_line = match_index.next_line - removed + inserted;
+		for (size_t i = 0; i < match_index.num_dirty; i++) {
+			struct LineRange *range = &match_index.dirty[i];
+			range->first = shift_line(range->first, line, removed, inserted);
+			range->end = shift_line(range->end, line, removed, inserted);
+		}
+	}
+	mark_lines_dirty(line, line + inserted);
+}
+
+/**
+ * Returns the compiled regex of the pattern, from the cache if possible.
+ * Patterns that match the empty string are rejected, they would match
+ * everywhere.
+ */
+static struct CachedRegex* compile_regex(const char *pattern, size_t length) {
+	struct CachedRegex *oldest = &regex_cache[0];
+	for (size_t i = 0; i < REGEX_CACHE_SIZE; i++) {
+		struct CachedRegex *cached = &regex_cache[i];
+		if (cached->last_use > 0 and cached->length == length and memcmp(cached->pattern, pattern, length) == 0) {
+			cached->last_use = ++num_regex_uses;
+			return cached;
+		}
+		if (cached->last_use < oldest->last_use) {
+			oldest = cached;
+		}
+	}
+	if (oldest->is_compiled) {
+		regfree(&oldest->regex);
+	}
+	char terminated[SEARCH_PATTERN_SIZE + 1];
+	memcpy(terminated, pattern, length);
+	terminated[length] = '\0';
+	oldest->is_compiled = regcomp(&oldest->regex, terminated, REG_EXTENDED | REG_NEWLINE) == 0;
+	if (oldest->is_compiled and regexec(&oldest->regex, "", 0, NULL, 0) == 0) {
+		regfree(&oldest->regex);
+		oldest->is_compiled = false;
+	}
+	memcpy(oldest->pattern, pattern, length);
+	oldest->length = length;
+	oldest->last_use = ++num_regex_uses;
+	return oldest;
+}
+
+static void clear_regex_cache(void) {
+	for (size_t i = 0; i < REGEX_CACHE_SIZE; i++) {
+		if (regex_cache[i].is_compiled) {
+			regfree(&regex_cache[i].regex);
+		}
+	}
+	memset(regex_cache, 0, sizeof(regex_cache));
+}
+
+/**
+ * Returns the end of the bracket expression starting at p. A ']' right
+ * after the '[' or '[^' is a member, so are those of "[:alpha:]" and the
+ * like.
+ */
+static const char* skip_bracket(const char *p, const char *end) {
+	p++;
+	p += p < end and *p == '^';
+	p += p < end and *p == ']';
+	for (; p < end; p++) {
+		if (*p == '[' and p + 1 < end and strchr(":.=", p[1]) != NULL) {
+			const char *close = p + 2;
+			while (close + 1 < end and not (close[0] == p[1] and close[1] == ']')) {
+				close++;
+			}
+			p = close + 1;
+		} else if (*p == ']') {
+			return p + 1;
+		}
+	}
+	return end;
+}
+
+/**
+ * Returns the end of the group or bracket expression starting at p.
+ */
+static const char* skip_nested(const char *p, const char *end) {
+	int depth = 0;
+	while (p < end) {
+		if (*p == '[') {
+			p = skip_bracket(p, end);
+		} else {
+			depth += (*p == '(') - (*p == ')');
+			p += *p == '\\' ? 2 : 1;
+		}
+		if (depth == 0) break;
+	}
+	return p < end ? p : end;
+}
+
+/**
+ * Finds the longest run of plain characters which every match of the
+ * regex contains, to reject lines without running the regex. Groups,
+ * brackets and optional characters end a run. An alternation at the top
+ * level means there is none.
+ */
+static void find_required_literal(void) {
+	const char *p = search.pattern, *end = p + search.length;
+	size_t run = 0;  /* characters at the end of the literal buffer */
+	char current[SEARCH_PATTERN_SIZE];
+	search.literal_length = 0;
+	while (p < end) {
+		bool is_plain = false;
+		char ch = *p;
+		if (ch == '|') {
+			search.literal_length = 0;
+			return;
+		} else if (ch == '\\' and p + 1 < end and ispunct((unsigned char)p[1]) and p[1] != '`' and p[1] != '\'') {
+			ch = p[1];
+			is_plain = true;
+			p += 2;
+		} else if (ch == '\\') {  /* Word boundaries, classes, back-references */
+			p += 2;
+		} else if (ch == '[' or ch == '(') {
+			p = skip_nested(p, end);
+		} else {
+			is_plain = strchr(".^$*+?{", ch) == NULL;
+			p++;
+		}
+		bool is_optional = false, is_repeated = false;
+		while (p < end and strchr("*+?{", *p) != NULL) {
+			is_optional |= *p == '*' or *p == '?' or (*p == '{' and p + 1 < end and p[1] == '0');
+			is_repeated = true;
+			p = *p == '{' and memchr(p, '}', end - p) ? (const char*)memchr(p, '}', end - p) + 1 : p + 1;
+		}
+		if (is_plain and not is_optional) {
+			current[run++] = ch;
+		}
+		if (not is_plain or is_repeated) {
+			if (run > search.literal_length) {
+				memcpy(search.literal, current, run);
+				search.literal_length = run;
+			}
+			run = 0;
+		}
+	}
+	if (run > search.literal_length) {
+		memcpy(search.literal, current, run);
+		search.literal_length = run;
+	}
+}
+
+/**
+ * Makes the pattern the one the scanners look for.
+ */
+static void set_pattern(const char *pattern, size_t length) {
+	memcpy(search.pattern, pattern, length);
+	search.length = length;
+	search.generation++;
+	search.is_valid = length > 0;
+	if (search.is_regex and search.is_valid) {
+		struct CachedRegex *cached = compile_regex(pattern, length);
+		search.is_valid = cached->is_compiled;
+		search.regex = &cached->regex;
+		find_required_literal();
+	} else if (not search.is_regex) {
+		memcpy(search.literal, pattern, length);
+		search.literal_length = length;
+	}
+	find_anchor();
+}
+
+void begin_search(size_t line, size_t column) {
+	set_pattern("", 0);
+	search.origin_line = line;
+	search.origin_column = column;
+	reset_match_index();
+}
+
+const struct SearchMatch* update_search(const char *pattern, size_t length, bool is_regex) {
+	length = min(length, SEARCH_PATTERN_SIZE);
+	size_t common = 0;  /* characters whose matches are known */
+	while (
+		not is_regex and not search.is_regex and
+		common < length and common < search.length and pattern[common] == search.pattern[common]
+	) {
+		common++;
+	}
+	if (is_regex != search.is_regex or length != search.length or common < length) {
+		reset_match_index();
+	}
+	if (is_regex) {  /* Any change may move the first match */
+		search.is_regex = true;
+		set_pattern(pattern, length);
+		if (length > 0) {
+			find_from(search.origin_line, search.origin_column, &search.matches[length - 1]);
+		}
+		return search.is_valid ? &search.matches[length - 1] : NULL;
+	}
+	search.is_regex = false;
+	for (size_t i = common; i < length; i++) {
+		set_pattern(pattern, i + 1);
+		struct SearchMatch *match = &search.matches[i];
+		if (i == 0) {
+			find_from(search.origin_line, search.origin_column, match);
+		} else if (search.matches[i - 1].is_found) {  /* Continue from the shorter match */
+			find_from(search.matches[i - 1].line, search.matches[i - 1].column, match);
+		} else {
+			match->is_found = false;
+		}
+	}
+	set_pattern(pattern, length);
+	return length == 0 ? NULL : &search.matches[length - 1];
+}
+
+/**
+ * The search of the user is set aside while the pattern is indexed with a
+ * scanner and an index of its own. The workers compile the regex of the
+ * search again afterwards, and its regex is looked up again in case the
+ * cache dropped it.
+ */
+struct IndexedMatch* collect_matches(const char *pattern, size_t length, bool is_regex, size_t *n) {
+	static struct Search saved_search;
+	struct MatchIndex saved_index = match_index;
+	saved_search = search;
+	memset(&search.scanner, 0, sizeof(search.scanner));
+	memset(&match_index, 0, sizeof(match_index));
+	search.is_regex = is_regex;
+	set_pattern(pattern, min(length, SEARCH_PATTERN_SIZE));
+	const struct IndexedMatch *matches = list_matches(n);
+	struct IndexedMatch *copy = malloc(sizeof(*copy) * max(*n, 1));
+	memcpy(copy, matches, sizeof(*copy) * *n);
+	free(search.scanner.scratch);
+	free(match_index.matches);
+	free(match_index.dirty);
+	size_t generation = search.generation;
+	search = saved_search;
+	match_index = saved_index;
+	search.generation = generation + 1;
+	if (search.is_regex and search.is_valid) {
+		search.regex = &compile_regex(search.pattern, search.length)->regex;
+	}
+	return copy;
+}
+
+bool find_next_match(size_t line, size_t column, struct SearchMatch *match) {
+	if (not search.is_valid) return false;
+	index_dirty_lines();
+	size_t position = lower_bound(line, column + 1);
+	if (position < match_index.num_matches or not is_indexing_matches()) {
+		if (match_index.num_matches == 0) return false;
+		struct IndexedMatch *next = &match_index.matches[position % match_index.num_matches];
+		match->line = next->line;
+		match->column = next->column;
+		match->is_found = true;
+		return true;
+	}
+	search.origin_line = line;  /* Not indexed that far yet */
+	search.origin_column = column + 1;
+	return find_from(line, column + 1, match);
+}
+
+void end_search(void) {
+	stop_search_pool();
+	set_pattern("", 0);
+	clear_regex_cache();
+	free(search.scanner.scratch);
+	free(match_index.matches);
+	free(match_index.dirty);
+	memset(&search.scanner, 0, sizeof(search.scanner));
+	memset(&match_index, 0, sizeof(match_index));
+}
+
+/**
+ * Looks up the matches of an indexed line, so that drawing does not run
+ * the regex on lines the search pool has scanned already.
+ */
+static bool find_indexed_match(size_t index, size_t from, size_t to, size_t *start, size_t *end) {
+	index_dirty_lines();
+	size_t position = lower_bound(index, from);
+	if (position > 0) {
+		struct IndexedMatch *previous = &match_index.matches[position - 1];
+		if (previous->line == index and previous->column + previous->length > from) position--;
+	}
+	if (position >= match_index.num_matches) return false;
+	struct IndexedMatch *match = &match_index.matches[position];
+	if (match->line != index or match->column >= to) return false;
+	*start = match->column;
+	*end = match->column + match->length;
+	return true;
+}
+
+bool find_line_match(size_t index, struct Line *line, size_t from, size_t to, size_t *start, size_t *end) {
+	if (search.is_valid and index < match_index.next_line) {
+		return find_indexed_match(index, from, to, start, end);
+	}
+	size_t column, length;
+	size_t begin = search.is_regex ? 0 : from - min(from, search.length - 1);
+	while (find_in_line(&search.scanner, line, begin, to, &column, &length)) {
+		if (column + length > from) {
+			*start = column;
+			*end = column + length;
+			return true;
+		}
+		begin = column + max(length, 1);
+	}
+	return false;
+}
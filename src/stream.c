@@ -0,0 +1,278 @@
+#include "clide.h"
+
+/**
+ * The file is scanned for newlines in blocks of this size.
+ */
+static const size_t scan_block_size = 1 << 20;
+
+/**
+ * Counts lines from the scan position on until a page is complete or the
+ * end of the file is reached. Returns false if nothing is left to scan.
+ */
+static bool scan_next_extent(struct PageScanner *scanner, struct PageExtent *extent) {
+	if (scanner->buffer == NULL) return false;  /* End of file reached before */
+	for (;;) {
+		if (scanner->position == scanner->length) {
+			scanner->buffer_offset += scanner->length;
+			ssize_t n = pread(scanner->fd, scanner->buffer, scan_block_size, scanner->buffer_offset);
+			scanner->length = n > 0 ? n : 0;
+			scanner->position = 0;
+		}
+		if (scanner->length == 0) {  /* The rest of the file is the tail */
+			off_t end = scanner->buffer_offset;
+			extent->offset = scanner->page_offset;
+			extent->size = end - scanner->page_offset;
+			extent->num_lines = scanner->num_lines + 1;
+			extent->is_tail = true;
+			free(scanner->buffer);
+			scanner->buffer = NULL;
+			return true;
+		}
+		const char *begin = scanner->buffer + scanner->position;
+		const char *newline = memchr(begin, '\n', scanner->length - scanner->position);
+		if (newline == NULL) {
+			scanner->position = scanner->length;
+			continue;
+		}
+		scanner->num_lines++;
+		scanner->line_offset = scanner->buffer_offset + (newline - scanner->buffer) + 1;
+		scanner->position = newline + 1 - scanner->buffer;
+		if (scanner->num_lines >= LINES_PER_PAGE) {
+			extent->offset = scanner->page_offset;
+			extent->size = scanner->line_offset - scanner->page_offset;
+			extent->num_lines = scanner->num_lines;
+			extent->is_tail = false;
+			scanner->page_offset = scanner->line_offset;
+			scanner->num_lines = 0;
+			return true;
+		}
+	}
+}
+
+static void append_stream_page(struct TextDocument *doc, struct PageExtent *extent) {
+	struct LinePage *page = calloc(1, sizeof(*page));
+	page->num_lines = extent->num_lines;
+	page->offset = extent->offset;
+	page->size = extent->size;
+	page->is_tail = extent->is_tail;
+	page->num_bytes = extent->size + extent->is_tail;  /* Counting a newline after the tail */
+	append_page(doc, page);
+	doc->stream->adopted_size = extent->offset + extent->size;
+}
+
+static bool stream_is_cancelled(struct DocumentStream *stream) {
+	pthread_mutex_lock(&stream->lock);
+	bool is_cancelled = stream->is_cancelled;
+	pthread_mutex_unlock(&stream->lock);
+	return is_cancelled;
+}
+
+static void publish_extent(struct DocumentStream *stream, struct PageExtent *extent) {
+	pthread_mutex_lock(&stream->lock);
+	if (stream->num_extents >= stream->capacity) {
+		stream->capacity = stream->capacity ? 2 * stream->capacity : 64;
+		stream->extents = realloc(stream->extents, sizeof(*stream->extents) * stream->capacity);
+	}
+	stream->extents[stream->num_extents++] = *extent;
+	pthread_mutex_unlock(&stream->lock);
+}
+
+static void* index_document_stream(void *argument) {
+	struct DocumentStream *stream = argument;
+	struct PageExtent extent;
+	while (not stream_is_cancelled(stream) and scan_next_extent(&stream->scanner, &extent)) {
+		publish_extent(stream, &extent);
+	}
+	free(stream->scanner.buffer);
+	stream->scanner.buffer = NULL;
+	pthread_mutex_lock(&stream->lock);
+	stream->is_indexing = false;
+	pthread_cond_broadcast(&stream->is_indexed);
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+void open_document_stream(struct TextDocument *doc, int fd) {
+	struct DocumentStream *stream = calloc(1, sizeof(*stream));
+	struct PageExtent extent;
+	stream->fd = fd;
+	stream->scanner.fd = fd;
+	stream->scanner.buffer = malloc(scan_block_size);
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->is_indexed, NULL);
+	doc->stream = stream;
+	scan_next_extent(&stream->scanner, &extent);  /* The first page is read right away */
+	append_stream_page(doc, &extent);
+	load_page(doc, doc->first_page);
+	if (extent.is_tail) {
+		stream->is_complete = true;
+	} else {
+		stream->is_indexing = true;
+		stream->is_joinable = true;
+		pthread_create(&stream->indexer, NULL, index_document_stream, stream);
+	}
+}
+
+static void join_indexer(struct DocumentStream *stream) {
+	if (stream->is_joinable) {
+		pthread_join(stream->indexer, NULL);
+		stream->is_joinable = false;
+	}
+}
+
+void close_document_stream(struct TextDocument *doc) {
+	struct DocumentStream *stream = doc->stream;
+	pthread_mutex_lock(&stream->lock);
+	stream->is_cancelled = true;
+	pthread_mutex_unlock(&stream->lock);
+	join_indexer(stream);
+	pthread_cond_destroy(&stream->is_indexed);
+	pthread_mutex_destroy(&stream->lock);
+	close(stream->fd);
+	free(stream->extents);
+	free(stream);
+	doc->stream = NULL;
+}
+
+bool update_document_stream(struct TextDocument *doc) {
+	struct DocumentStream *stream = doc->stream;
+	if (stream == NULL or stream->is_complete) return false;
+	pthread_mutex_lock(&stream->lock);
+	bool has_tail = false;
+	for (size_t i = 0; i < stream->num_extents; i++) {
+		append_stream_page(doc, &stream->extents[i]);
+		has_tail = stream->extents[i].is_tail;
+	}
+	stream->num_extents = 0;
+	bool is_indexing = stream->is_indexing;
+	pthread_mutex_unlock(&stream->lock);
+	stream->is_complete = has_tail or not is_indexing;  /* The indexer may not have noted it yet */
+	return not stream->is_complete;
+}
+
+void finish_document_stream(struct TextDocument *doc) {
+	join_indexer(doc->stream);
+	update_document_stream(doc);
+}
+
+off_t wait_for_stream_index(struct DocumentStream *stream) {
+	pthread_mutex_lock(&stream->lock);
+	while (stream->is_indexing) {
+		pthread_cond_wait(&stream->is_indexed, &stream->lock);
+	}
+	off_t size = stream->scanner.buffer_offset;  /* Where it found the end */
+	pthread_mutex_unlock(&stream->lock);
+	return size;
+}
+
+static void unlink_page(struct DocumentStream *stream, struct LinePage *page) {
+	if (page->newer != NULL) page->newer->older = page->older;
+	else stream->newest = page->older;
+	if (page->older != NULL) page->older->newer = page->newer;
+	else stream->oldest = page->newer;
+	page->newer = page->older = NULL;
+	stream->num_resident--;
+}
+
+static void link_page(struct DocumentStream *stream, struct LinePage *page) {
+	page->older = stream->newest;
+	page->newer = NULL;
+	if (stream->newest != NULL) stream->newest->newer = page;
+	else stream->oldest = page;
+	stream->newest = page;
+	stream->num_resident++;
+}
+
+static void unload_page(struct LinePage *page) {
+	for (size_t i = 0; i < page->num_lines; i++) {
+		free_line(page->lines[i]);
+	}
+	free(page->lines);
+	page->lines = NULL;
+}
+
+static void trim_resident_pages(struct DocumentStream *stream) {
+	while (stream->num_resident > MAX_RESIDENT_PAGES) {
+		struct LinePage *oldest = stream->oldest;
+		unlink_page(stream, oldest);
+		unload_page(oldest);
+	}
+}
+
+struct PageLoader {
+	struct LinePage *page;
+	size_t num_lines;
+};
+
+static void append_page_line(void *context, const char *text, size_t length) {
+	struct PageLoader *loader = context;
+	assert (loader->num_lines < loader->page->num_lines);
+	loader->page->lines[loader->num_lines++] = create_line_from_text(text, length);
+}
+
+void load_page(struct TextDocument *doc, struct LinePage *page) {
+	struct DocumentStream *stream = doc->stream;
+	struct PageLoader loader = {page, 0};
+	char *buffer = malloc(page->size);
+	size_t size = 0;
+	while (size < page->size) {
+		ssize_t n = pread(stream->fd, buffer + size, page->size - size, page->offset + size);
+		if (n <= 0) break;
+		size += n;
+	}
+	page->capacity = max(page->num_lines, 2 * LINES_PER_PAGE);
+	page->lines = malloc(sizeof(*page->lines) * page->capacity);
+	split_lines(buffer, size, page->is_tail, append_page_line, &loader);
+	while (loader.num_lines < page->num_lines) {  /* File shrunk meanwhile */
+		append_page_line(&loader, "", 0);
+	}
+	free(buffer);
+	link_page(stream, page);
+	trim_resident_pages(stream);
+}
+
+void touch_page(struct TextDocument *doc, struct LinePage *page) {
+	if (doc->stream->newest != page) {
+		unlink_page(doc->stream, page);
+		link_page(doc->stream, page);
+	}
+}
+
+void pin_page(struct TextDocument *doc, struct LinePage *page) {
+	if (doc->stream != NULL and not page->is_pinned) {
+		unlink_page(doc->stream, page);
+	}
+	page->is_pinned = true;
+}
+
+bool copy_extent(int source, const struct PageExtent *extent, int fd) {
+	size_t size = extent->is_tail ? extent->size : extent->size - 1;  /* Skip newline */
+	char *buffer = malloc(scan_block_size);
+	off_t offset = extent->offset;
+	errno = 0;
+	while (size > 0) {
+		ssize_t n = pread(source, buffer, min(size, scan_block_size), offset);
+		if (n <= 0 or not write_fully(fd, buffer, n)) break;
+		offset += n;
+		size -= n;
+	}
+	free(buffer);
+	return size == 0;
+}
+
+void reopen_document_stream(struct TextDocument *doc) {
+	struct DocumentStream *stream = doc->stream;
+	int fd = open(doc->path, O_RDONLY);
+	if (fd < 0) {  /* Keep everything resident rather than losing edits */
+		return;
+	}
+	close(stream->fd);
+	stream->fd = fd;
+	for (struct LinePage *page = doc->first_page; page != NULL; page = page->next) {
+		if (page->is_pinned and page->lines != NULL) {
+			page->is_pinned = false;
+			link_page(stream, page);
+		}
+	}
+	trim_resident_pages(stream);
+}
@@ -0,0 +1,655 @@
+#include "clide.h"
+
+struct LinePage* create_page(size_t capacity) {
+	struct LinePage *page = calloc(1, sizeof(*page));
+	page->capacity = capacity;
+	page->lines = malloc(sizeof(*page->lines) * capacity);
+	page->offset = -1;  /* Not backed by a file */
+	return page;
+}
+
+void free_page(struct LinePage *page) {
+	if (page->lines != NULL) {
+		for (size_t i = 0; i < page->num_lines; i++) {
+			free_line(page->lines[i]);
+		}
+		free(page->lines);
+	}
+	free(page);
+}
+
+static size_t lines_of(void *child, int height) {
+	if (height == 0) {
+		return ((struct LinePage*)child)->num_lines;
+	}
+	return ((struct PageNode*)child)->num_lines;
+}
+
+static size_t bytes_of(void *child, int height) {
+	if (height == 0) {
+		return ((struct LinePage*)child)->num_bytes;
+	}
+	return ((struct PageNode*)child)->num_bytes;
+}
+
+static size_t bytes_of_line(struct Line *line) {
+	return length_of(line) + 1;
+}
+
+/**
+ * Sums the bytes of the lines of a page, or takes those it spans within
+ * the file if it is not resident. Only the tail lacks a final newline.
+ */
+static size_t count_page_bytes(struct LinePage *page) {
+	if (page->lines == NULL) {
+		return page->size + page->is_tail;
+	}
+	size_t num_bytes = 0;
+	for (size_t i = 0; i < page->num_lines; i++) {
+		num_bytes += bytes_of_line(page->lines[i]);
+	}
+	return num_bytes;
+}
+
+/**
+ * Returns the child of node containing the line at *index and makes *index
+ * relative to that child. Indices past the end map to the last child.
+ */
+static size_t child_at(struct PageNode *node, size_t *index) {
+	size_t i = 0;
+	while (i + 1 < node->num_children and *index >= node->counts[i]) {
+		*index -= node->counts[i];
+		i++;
+	}
+	return i;
+}
+
+static void forget_recent_page(struct TextDocument *doc) {
+	doc->recent_page = NULL;
+}
+
+struct LinePage* find_page(struct TextDocument *doc, size_t index, size_t *first_line) {
+	struct LinePage *recent = doc->recent_page;
+	if (recent != NULL and index >= doc->recent_first_line
+			and index - doc->recent_first_line < recent->num_lines) {
+		*first_line = doc->recent_first_line;
+		return recent;
+	}
+	void *node = doc->root;
+	size_t local = index;
+	for (int height = doc->height; height > 0; height--) {
+		struct PageNode *parent = node;
+		node = parent->children[child_at(parent, &local)];
+	}
+	doc->recent_page = node;
+	doc->recent_first_line = *first_line = index - local;
+	return node;
+}
+
+/**
+ * Sums the bytes of the pages edited since they were last summed and
+ * corrects the sizes along their paths. Their lines have not moved since.
+ */
+static void sum_resized_pages(struct TextDocument *doc) {
+	for (size_t k = 0; k < doc->num_resized_lines; k++) {
+		size_t first_line;
+		struct LinePage *page = find_page(doc, doc->resized_lines[k], &first_line);
+		size_t num_bytes = count_page_bytes(page);
+		size_t delta = num_bytes - page->num_bytes;  /* Wraps around if it shrank */
+		void *node = doc->root;
+		size_t local = first_line;
+		for (int height = doc->height; height > 0; height--) {
+			struct PageNode *parent = node;
+			size_t i = child_at(parent, &local);
+			parent->sizes[i] += delta;
+			parent->num_bytes += delta;
+			node = parent->children[i];
+		}
+		page->num_bytes = num_bytes;
+		page->is_resized = false;
+		doc->num_bytes += delta;
+	}
+	doc->num_resized_lines = 0;
+}
+
+static void link_page_after(struct TextDocument *doc, struct LinePage *page, struct LinePage *next) {
+	next->prev = page;
+	next->next = page->next;
+	if (page->next != NULL) page->next->prev = next;
+	else doc->last_page = next;
+	page->next = next;
+	doc->num_pages++;
+}
+
+static void unlink_page_from_document(struct TextDocument *doc, struct LinePage *page) {
+	if (page->prev != NULL) page->prev->next = page->next;
+	else doc->first_page = page->next;
+	if (page->next != NULL) page->next->prev = page->prev;
+	else doc->last_page = page->prev;
+	doc->num_pages--;
+}
+
+static void insert_child(struct PageNode *node, size_t index, void *child, size_t count, size_t size) {
+	assert (node->num_children < PAGE_NODE_FANOUT);
+	memmove(node->children + index + 1, node->children + index, sizeof(*node->children) * (node->num_children - index));
+	memmove(node->counts + index + 1, node->counts + index, sizeof(*node->counts) * (node->num_children - index));
+	memmove(node->sizes + index + 1, node->sizes + index, sizeof(*node->sizes) * (node->num_children - index));
+	node->children[index] = child;
+	node->counts[index] = count;
+	node->sizes[index] = size;
+	node->num_children++;
+	node->num_lines += count;
+	node->num_bytes += size;
+}
+
+static void remove_child(struct PageNode *node, size_t index) {
+	node->num_lines -= node->counts[index];
+	node->num_bytes -= node->sizes[index];
+	node->num_children--;
+	memmove(node->children + index, node->children + index + 1, sizeof(*node->children) * (node->num_children - index));
+	memmove(node->counts + index, node->counts + index + 1, sizeof(*node->counts) * (node->num_children - index));
+	memmove(node->sizes + index, node->sizes + index + 1, sizeof(*node->sizes) * (node->num_children - index));
+}
+
+/**
+ * Moves the upper half of the children of a full node into a new node.
+ */
+static struct PageNode* split_node(struct PageNode *node) {
+	struct PageNode *next = calloc(1, sizeof(*next));
+	size_t keep = node->num_children / 2;
+	for (size_t i = keep; i < node->num_children; i++) {
+		insert_child(next, next->num_children, node->children[i], node->counts[i], node->sizes[i]);
+		node->num_lines -= node->counts[i];
+		node->num_bytes -= node->sizes[i];
+	}
+	node->num_children = keep;
+	return next;
+}
+
+/**
+ * Inserts a child after index into node, splitting the node if it is full.
+ * Returns the new right half of a split node or NULL.
+ */
+static struct PageNode* insert_child_after(struct PageNode *node, size_t index, void *child, size_t count, size_t size) {
+	struct PageNode *next = NULL;
+	if (node->num_children == PAGE_NODE_FANOUT) {
+		next = split_node(node);
+		if (index >= node->num_children) {
+			insert_child(next, index + 1 - node->num_children, child, count, size);
+			return next;
+		}
+	}
+	insert_child(node, index + 1, child, count, size);
+	return next;
+}
+
+/**
+ * The root grew a sibling, so the tree grows by one level.
+ */
+static void grow_tree(struct TextDocument *doc, void *sibling) {
+	struct PageNode *root = calloc(1, sizeof(*root));
+	insert_child(root, 0, doc->root, lines_of(doc->root, doc->height), bytes_of(doc->root, doc->height));
+	insert_child(root, 1, sibling, lines_of(sibling, doc->height), bytes_of(sibling, doc->height));
+	doc->root = root;
+	doc->height++;
+}
+
+static void* append_to_node(struct TextDocument *doc, void *node, int height, struct LinePage *page) {
+	struct PageNode *parent = node;
+	size_t last = parent->num_children - 1;
+	void *split = page;
+	if (height > 1) {
+		split = append_to_node(doc, parent->children[last], height - 1, page);
+		parent->counts[last] = lines_of(parent->children[last], height - 1);
+		parent->sizes[last] = bytes_of(parent->children[last], height - 1);
+		parent->num_lines += page->num_lines;
+		parent->num_bytes += page->num_bytes;
+		if (split == NULL) return NULL;
+		parent->num_lines -= lines_of(split, height - 1);  /* Re-added by insert_child */
+		parent->num_bytes -= bytes_of(split, height - 1);
+	}
+	return insert_child_after(parent, last, split, lines_of(split, height - 1), bytes_of(split, height - 1));
+}
+
+void append_page(struct TextDocument *doc, struct LinePage *page) {
+	if (doc->root == NULL) {
+		doc->root = doc->first_page = doc->last_page = page;
+		doc->num_pages = 1;
+	} else {
+		link_page_after(doc, doc->last_page, page);
+		void *split = page;
+		if (doc->height > 0) {
+			split = append_to_node(doc, doc->root, doc->height, page);
+		}
+		if (split != NULL) {
+			grow_tree(doc, split);
+		}
+	}
+	doc->num_lines += page->num_lines;
+	doc->num_bytes += page->num_bytes;
+}
+
+static struct LinePage* access_resident_page(struct TextDocument *doc, struct LinePage *page) {
+	if (page->lines == NULL) {
+		load_page(doc, page);
+	}
+	pin_page(doc, page);
+	return page;
+}
+
+static void reserve_page_lines(struct LinePage *page, size_t num_lines) {
+	if (num_lines > page->capacity) {
+		page->capacity = max(num_lines, 2 * page->capacity);
+		page->lines = realloc(page->lines, sizeof(*page->lines) * page->capacity);
+	}
+}
+
+/**
+ * Splits a full page in two. Appending to the last page starts a new page
+ * instead, which keeps the pages of growing documents densely filled.
+ */
+static struct LinePage* split_page(struct TextDocument *doc, struct LinePage *page, bool is_append) {
+	size_t keep = is_append ? page->num_lines : page->num_lines / 2;
+	size_t num_lines = page->num_lines - keep;
+	struct LinePage *next = create_page(max(num_lines, LINES_PER_PAGE));
+	next->is_pinned = true;
+	next->num_lines = num_lines;
+	memcpy(next->lines, page->lines + keep, sizeof(*page->lines) * num_lines);
+	page->num_lines = keep;
+	next->num_bytes = count_page_bytes(next);
+	page->num_bytes -= next->num_bytes;
+	link_page_after(doc, page, next);
+	forget_recent_page(doc);
+	return next;
+}
+
+static struct LinePage* insert_into_page(struct TextDocument *doc, struct LinePage *page, size_t index, struct Line *line) {
+	struct LinePage *next = NULL;
+	access_resident_page(doc, page);
+	if (page->num_lines >= 2 * LINES_PER_PAGE) {
+		next = split_page(doc, page, index == page->num_lines and page->next == NULL);
+		if (index >= page->num_lines) {
+			index -= page->num_lines;
+			page = next;
+		}
+	}
+	reserve_page_lines(page, page->num_lines + 1);
+	memmove(  /* Make room for the new line */
+		page->lines + index + 1,
+		page->lines + index,
+		sizeof(*page->lines) * (page->num_lines - index)
+	);
+	page->lines[index] = line;
+	page->num_lines++;
+	page->num_bytes += bytes_of_line(line);
+	return next;
+}
+
+static void* insert_into_node(struct TextDocument *doc, void *node, int height, size_t index, struct Line *line) {
+	if (height == 0) {
+		return insert_into_page(doc, node, index, line);
+	}
+	struct PageNode *parent = node;
+	size_t i = child_at(parent, &index);
+	void *split = insert_into_node(doc, parent->children[i], height - 1, index, line);
+	parent->num_lines++;
+	parent->num_bytes += bytes_of_line(line);
+	if (split == NULL) {
+		parent->counts[i]++;
+		parent->sizes[i] += bytes_of_line(line);
+		return NULL;
+	}
+	size_t count = lines_of(split, height - 1);
+	size_t size = bytes_of(split, height - 1);
+	parent->counts[i] = lines_of(parent->children[i], height - 1);
+	parent->sizes[i] = bytes_of(parent->children[i], height - 1);
+	parent->num_lines -= count;  /* Re-added by insert_child */
+	parent->num_bytes -= size;
+	return insert_child_after(parent, i, split, count, size);
+}
+
+void insert_page_line(struct TextDocument *doc, size_t index, struct Line *line) {
+	assert (index <= doc->num_lines);
+	sum_resized_pages(doc);
+	if (doc->recent_page != NULL and index < doc->recent_first_line) {
+		doc->recent_first_line++;
+	}
+	void *split = insert_into_node(doc, doc->root, doc->height, index, line);
+	if (split != NULL) {
+		grow_tree(doc, split);
+	}
+	doc->num_lines++;
+	doc->num_bytes += bytes_of_line(line);
+}
+
+static void merge_pages(struct TextDocument *doc, struct LinePage *page, struct LinePage *next) {
+	pin_page(doc, page);
+	pin_page(doc, next);
+	reserve_page_lines(page, page->num_lines + next->num_lines);
+	memcpy(page->lines + page->num_lines, next->lines, sizeof(*next->lines) * next->num_lines);
+	page->num_lines += next->num_lines;
+	page->num_bytes += next->num_bytes;
+	next->num_lines = 0;
+	unlink_page_from_document(doc, next);
+	free_page(next);
+}
+
+static void free_node(void *node, int height) {
+	if (height == 0) {
+		free_page(node);
+		return;
+	}
+	struct PageNode *parent = node;
+	for (size_t i = 0; i < parent->num_children; i++) {
+		free_node(parent->children[i], height - 1);
+	}
+	free(parent);
+}
+
+/**
+ * Merges the children at index and index+1 of node if they fit together.
+ */
+static void merge_children(struct TextDocument *doc, struct PageNode *node, size_t index, int height) {
+	void *left = node->children[index];
+	void *right = node->children[index + 1];
+	if (height == 0) {
+		struct LinePage *page = left, *next = right;
+		if (page->lines == NULL or next->lines == NULL) return;  /* Not resident */
+		if (page->num_lines + next->num_lines > LINES_PER_PAGE) return;
+		merge_pages(doc, page, next);
+	} else {
+		struct PageNode *child = left, *sibling = right;
+		if (child->num_children + sibling->num_children > PAGE_NODE_FANOUT) return;
+		for (size_t i = 0; i < sibling->num_children; i++) {
+			insert_child(child, child->num_children, sibling->children[i], sibling->counts[i], sibling->sizes[i]);
+		}
+		free(sibling);
+	}
+	node->counts[index] += node->counts[index + 1];
+	node->sizes[index] += node->sizes[index + 1];
+	node->num_lines += node->counts[index + 1];  /* Subtracted by remove_child */
+	node->num_bytes += node->sizes[index + 1];
+	remove_child(node, index + 1);
+	forget_recent_page(doc);
+}
+
+/**
+ * Drops the child at index of node if it has run empty
+ * or merges it with a neighbour if it has become small.
+ */
+static void rebalance_child(struct TextDocument *doc, struct PageNode *node, size_t index, int height) {
+	void *child = node->children[index];
+	bool is_empty = height == 0
+		? ((struct LinePage*)child)->num_lines == 0
+		: ((struct PageNode*)child)->num_children == 0;
+	bool is_small = height == 0
+		? ((struct LinePage*)child)->num_lines < LINES_PER_PAGE / 4
+		: ((struct PageNode*)child)->num_children < PAGE_NODE_FANOUT / 4;
+	if (is_empty) {
+		if (height == 0) {
+			unlink_page_from_document(doc, child);
+		}
+		free_node(child, height);
+		remove_child(node, index);
+		forget_recent_page(doc);
+	} else if (is_small and index + 1 < node->num_children) {
+		merge_children(doc, node, index, height);
+	} else if (is_small and index > 0) {
+		merge_children(doc, node, index - 1, height);
+	}
+}
+
+static struct Line* remove_from_node(struct TextDocument *doc, void *node, int height, size_t index) {
+	if (height == 0) {
+		struct LinePage *page = access_resident_page(doc, node);
+		struct Line *line = page->lines[index];
+		memmove(  /* Overwrite the line at index */
+			page->lines + index,
+			page->lines + index + 1,
+			sizeof(*page->lines) * (page->num_lines - index - 1)
+		);
+		page->num_lines--;
+		page->num_bytes -= bytes_of_line(line);
+		return line;
+	}
+	struct PageNode *parent = node;
+	size_t i = child_at(parent, &index);
+	struct Line *line = remove_from_node(doc, parent->children[i], height - 1, index);
+	parent->counts[i]--;
+	parent->sizes[i] -= bytes_of_line(line);
+	parent->num_lines--;
+	parent->num_bytes -= bytes_of_line(line);
+	if (doc->num_lines > 1) {  /* The last page of the document is kept */
+		rebalance_child(doc, parent, i, height - 1);
+	}
+	return line;
+}
+
+struct Line* remove_page_line(struct TextDocument *doc, size_t index) {
+	assert (index < doc->num_lines);
+	sum_resized_pages(doc);
+	if (doc->recent_page != NULL and index < doc->recent_first_line) {
+		doc->recent_first_line--;
+	}
+	struct Line *line = remove_from_node(doc, doc->root, doc->height, index);
+	doc->num_lines--;
+	doc->num_bytes -= bytes_of_line(line);
+	while (doc->height > 0 and ((struct PageNode*)doc->root)->num_children == 1) {
+		struct PageNode *root = doc->root;  /* Shrink the tree by one level */
+		doc->root = root->children[0];
+		doc->height--;
+		free(root);
+	}
+	return line;
+}
+
+static void free_inner_nodes(void *node, int height) {
+	if (height == 0) return;
+	struct PageNode *parent = node;
+	for (size_t i = 0; i < parent->num_children; i++) {
+		free_inner_nodes(parent->children[i], height - 1);
+	}
+	free(parent);
+}
+
+/**
+ * Builds the inner nodes anew from the chain of pages, level by level,
+ * spreading the children evenly. Bulk edits splice pages into the chain
+ * and then call this, which is linear in the number of pages.
+ */
+static void rebuild_page_tree(struct TextDocument *doc) {
+	if (doc->root != NULL) {
+		free_inner_nodes(doc->root, doc->height);
+	}
+	void **level = malloc(sizeof(*level) * doc->num_pages);
+	size_t count = 0;
+	doc->num_lines = 0;
+	doc->num_bytes = 0;
+	for (struct LinePage *page = doc->first_page; page != NULL; page = page->next) {
+		level[count++] = page;
+		doc->num_lines += page->num_lines;
+		doc->num_bytes += page->num_bytes;
+	}
+	int height = 0;
+	while (count > 1) {
+		size_t num_nodes = (count + PAGE_NODE_FANOUT - 1) / PAGE_NODE_FANOUT;
+		for (size_t i = 0, k = 0; i < num_nodes; i++) {
+			struct PageNode *node = calloc(1, sizeof(*node));
+			for (size_t end = (i + 1) * count / num_nodes; k < end; k++) {
+				insert_child(node, node->num_children, level[k], lines_of(level[k], height), bytes_of(level[k], height));
+			}
+			level[i] = node;  /* Never ahead of k */
+		}
+		count = num_nodes;
+		height++;
+	}
+	doc->root = level[0];
+	doc->height = height;
+	free(level);
+	forget_recent_page(doc);
+}
+
+void insert_page_lines(struct TextDocument *doc, size_t index, struct Line **lines, size_t n) {
+	assert (index <= doc->num_lines);
+	sum_resized_pages(doc);
+	if (n < LINES_PER_PAGE) {
+		for (size_t i = 0; i < n; i++) {
+			insert_page_line(doc, index + i, lines[i]);
+		}
+		return;
+	}
+	size_t first_line;
+	struct LinePage *page = access_resident_page(doc, find_page(doc, index, &first_line));
+	size_t local = index - first_line;
+	size_t tail = page->num_lines - local;
+	struct LinePage *last = page;
+	for (size_t i = 0; i < n; i += LINES_PER_PAGE) {
+		size_t count = min(n - i, LINES_PER_PAGE);
+		struct LinePage *next = create_page(i + count < n ? count : count + tail);
+		memcpy(next->lines, lines + i, sizeof(*lines) * count);
+		next->num_lines = count;
+		next->is_pinned = true;
+		link_page_after(doc, last, next);
+		last = next;
+	}
+	memcpy(last->lines + last->num_lines, page->lines + local, sizeof(*lines) * tail);
+	last->num_lines += tail;
+	page->num_lines = local;
+	for (struct LinePage *next = page; next != last->next; next = next->next) {
+		next->num_bytes = count_page_bytes(next);
+	}
+	if (page->num_lines == 0) {
+		unlink_page_from_document(doc, page);
+		free_page(page);
+	}
+	rebuild_page_tree(doc);
+}
+
+void remove_page_lines(struct TextDocument *doc, size_t index, size_t n) {
+	assert (index + n <= doc->num_lines);
+	sum_resized_pages(doc);
+	if (n < LINES_PER_PAGE) {
+		for (size_t i = 0; i < n; i++) {
+			free_line(remove_page_line(doc, index));
+		}
+		return;
+	}
+	size_t first_line;
+	struct LinePage *page = find_page(doc, index, &first_line);
+	size_t local = index - first_line;
+	while (n > 0) {
+		struct LinePage *next = page->next;
+		size_t count = min(n, page->num_lines - local);
+		if (count == page->num_lines) {  /* Whole pages are dropped unread */
+			if (page->lines != NULL) {
+				pin_page(doc, page);
+			}
+			unlink_page_from_document(doc, page);
+			free_page(page);
+		} else {
+			access_resident_page(doc, page);
+			for (size_t i = local; i < local + count; i++) {
+				free_line(page->lines[i]);
+			}
+			memmove(
+				page->lines + local,
+				page->lines + local + count,
+				sizeof(*page->lines) * (page->num_lines - local - count)
+			);
+			page->num_lines -= count;
+			page->num_bytes = count_page_bytes(page);
+		}
+		n -= count;
+		local = 0;
+		page = next;
+	}
+	if (doc->first_page == NULL) {  /* Documents keep one page */
+		page = create_page(LINES_PER_PAGE);
+		page->is_pinned = true;
+		doc->first_page = doc->last_page = page;
+		doc->num_pages = 1;
+	}
+	rebuild_page_tree(doc);
+}
+
+void free_page_tree(struct TextDocument *doc) {
+	if (doc->root != NULL) {
+		free_node(doc->root, doc->height);
+	}
+	doc->root = doc->first_page = doc->last_page = doc->recent_page = NULL;
+	doc->height = 0;
+	doc->num_pages = 0;
+	doc->num_lines = 0;
+	doc->num_bytes = 0;
+	free(doc->resized_lines);
+	doc->resized_lines = NULL;
+	doc->num_resized_lines = doc->resized_capacity = 0;
+}
+
+void mark_page_resized(struct TextDocument *doc, struct LinePage *page, size_t index) {
+	if (page->is_resized) return;
+	page->is_resized = true;
+	if (doc->num_resized_lines >= doc->resized_capacity) {
+		doc->resized_capacity = doc->resized_capacity ? 2 * doc->resized_capacity : 16;
+		doc->resized_lines = realloc(doc->resized_lines, sizeof(*doc->resized_lines) * doc->resized_capacity);
+	}
+	doc->resized_lines[doc->num_resized_lines++] = index;
+}
+
+static struct LinePage* access_page_lines(struct TextDocument *doc, struct LinePage *page) {
+	if (page->lines == NULL) {
+		load_page(doc, page);
+	} else if (doc->stream != NULL and not page->is_pinned) {
+		touch_page(doc, page);
+	}
+	return page;
+}
+
+size_t offset_of_line(struct TextDocument *doc, size_t index) {
+	sum_resized_pages(doc);
+	if (index >= doc->num_lines) return size_of_document(doc);
+	size_t offset = 0;
+	void *node = doc->root;
+	for (int height = doc->height; height > 0; height--) {
+		struct PageNode *parent = node;
+		size_t i = 0;
+		for (; i + 1 < parent->num_children and index >= parent->counts[i]; i++) {
+			index -= parent->counts[i];
+			offset += parent->sizes[i];
+		}
+		node = parent->children[i];
+	}
+	struct LinePage *page = access_page_lines(doc, node);
+	for (size_t i = 0; i < index; i++) {
+		offset += bytes_of_line(page->lines[i]);
+	}
+	return offset;
+}
+
+size_t line_at_offset(struct TextDocument *doc, size_t offset, size_t *line_offset) {
+	sum_resized_pages(doc);
+	size_t index = 0;
+	size_t local = offset;
+	void *node = doc->root;
+	for (int height = doc->height; height > 0; height--) {
+		struct PageNode *parent = node;
+		size_t i = 0;
+		for (; i + 1 < parent->num_children and local >= parent->sizes[i]; i++) {
+			local -= parent->sizes[i];
+			index += parent->counts[i];
+		}
+		node = parent->children[i];
+	}
+	struct LinePage *page = access_page_lines(doc, node);
+	for (size_t i = 0; i + 1 < page->num_lines and local >= bytes_of_line(page->lines[i]); i++) {
+		local -= bytes_of_line(page->lines[i]);
+		index++;
+	}
+	*line_offset = offset - local;
+	return index;
+}
+
+size_t size_of_document(struct TextDocument *doc) {
+	sum_resized_pages(doc);
+	return doc->num_bytes - (doc->num_lines > 0);  /* No newline after the last line */
+}
@@ -0,0 +1,154 @@
+#include "clide.h"
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+#define ZERO_WIDTH_JOINER 0x200D
+
+/**
+ * Tests eight bytes at a time, text is mostly ASCII.
+ */
+size_t count_ascii(const char *text, size_t n) {
+	static const uint64_t high_bits = 0x8080808080808080ull;
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		uint64_t words[4];
+		memcpy(words, text + i, sizeof(words));
+		if ((words[0] | words[1] | words[2] | words[3]) & high_bits) break;
+	}
+	for (; i + 8 <= n; i += 8) {
+		uint64_t word;
+		memcpy(&word, text + i, sizeof(word));
+		if (word & high_bits) break;
+	}
+	while (i < n and (unsigned char)text[i] < 0x80) i++;
+	return i;
+}
+
+size_t decode_character(const char *text, size_t n, uint32_t *codepoint) {
+	const unsigned char *bytes = (const unsigned char*)text;
+	size_t length;
+	uint32_t minimum;
+	if (bytes[0] < 0x80) {
+		*codepoint = bytes[0];
+		return 1;
+	} else if ((bytes[0] & 0xE0) == 0xC0) {
+		length = 2;
+		minimum = 0x80;
+		*codepoint = bytes[0] & 0x1F;
+	} else if ((bytes[0] & 0xF0) == 0xE0) {
+		length = 3;
+		minimum = 0x800;
+		*codepoint = bytes[0] & 0x0F;
+	} else if ((bytes[0] & 0xF8) == 0xF0) {
+		length = 4;
+		minimum = 0x10000;
+		*codepoint = bytes[0] & 0x07;
+	} else {
+		length = 0;
+		minimum = 0;
+	}
+	for (size_t i = 1; i < length; i++) {
+		if (i >= n or (bytes[i] & 0xC0) != 0x80) {
+			length = 0;
+			break;
+		}
+		*codepoint = *codepoint << 6 | (bytes[i] & 0x3F);
+	}
+	if (
+		length == 0 or *codepoint < minimum or *codepoint > 0x10FFFF or
+		(*codepoint >= 0xD800 and *codepoint <= 0xDFFF)
+	) {
+		*codepoint = REPLACEMENT_CHARACTER;
+		return 1;
+	}
+	return length;
+}
+
+int character_width(uint32_t codepoint) {
+	if (codepoint < 0x80) return 1;  /* Control characters are drawn as one cell */
+	int width = wcwidth(codepoint);
+	return width < 0 ? 1 : width;
+}
+
+/**
+ * Copies up to n bytes of the line from the given position on, which may
+ * span chunks of a long line.
+ */
+static size_t peek_bytes(struct Line *line, size_t position, char *buffer, size_t n) {
+	n = min(n, length_of(line) - position);
+	for (size_t copied = 0, m; copied < n; copied += m) {
+		const char *segment = segment_of(line, position + copied, &m);
+		m = min(m, n - copied);
+		memcpy(buffer + copied, segment, m);
+	}
+	return n;
+}
+
+uint32_t codepoint_at(struct Line *line, size_t position, size_t *length) {
+	char buffer[4];
+	uint32_t codepoint;
+	*length = decode_character(buffer, peek_bytes(line, position, buffer, sizeof(buffer)), &codepoint);
+	return codepoint;
+}
+
+/**
+ * Characters are approximated grapheme clusters: a codepoint followed by
+ * those that are drawn on top of it, such as combining marks, and by those
+ * that follow a zero width joiner.
+ */
+static bool joins(uint32_t previous, uint32_t codepoint) {
+	return codepoint >= 0x80 and (character_width(codepoint) == 0 or previous == ZERO_WIDTH_JOINER);
+}
+
+static bool is_ascii_at(struct Line *line, size_t position) {
+	return (unsigned char)character_of(line, position) < 0x80;
+}
+
+size_t next_character(struct Line *line, size_t position) {
+	size_t length = length_of(line);
+	if (position >= length) return length;
+	if (is_ascii_at(line, position) and (position + 1 == length or is_ascii_at(line, position + 1))) {
+		return position + 1;
+	}
+	size_t n;
+	uint32_t previous = codepoint_at(line, position, &n);
+	for (position += n; position < length; position += n) {
+		uint32_t codepoint = codepoint_at(line, position, &n);
+		if (not joins(previous, codepoint)) break;
+		previous = codepoint;
+	}
+	return position;
+}
+
+/**
+ * Returns the start of the encoded codepoint the byte at the given
+ * position belongs to.
+ */
+static size_t codepoint_start(struct Line *line, size_t position) {
+	size_t start = position;
+	while (start > 0 and position - start < 3 and ((unsigned char)character_of(line, start) & 0xC0) == 0x80) {
+		start--;
+	}
+	size_t n;
+	codepoint_at(line, start, &n);
+	return start + n > position ? start : position;
+}
+
+/**
+ * Steps back over the codepoints that join the character before the given
+ * position, then forward again from there, so that both directions agree
+ * on where characters begin.
+ */
+size_t previous_character(struct Line *line, size_t position) {
+	if (position == 0) return 0;
+	if (is_ascii_at(line, position - 1) and (position == length_of(line) or is_ascii_at(line, position))) {
+		return position - 1;
+	}
+	size_t start = codepoint_start(line, position - 1);
+	while (start > 0) {
+		size_t n, previous = codepoint_start(line, start - 1);
+		if (not joins(codepoint_at(line, previous, &n), codepoint_at(line, start, &n))) break;
+		start = previous;
+	}
+	for (size_t next; (next = next_character(line, start)) < position; start = next);
+	return start;
+}
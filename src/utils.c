@@ -4,6 +4,10 @@ size_t min(size_t a, size_t b) {
 	return a <= b ? a : b;
 }
 
+size_t max(size_t a, size_t b) {
+	return a >= b ? a : b;
+}
+
 char* strdup(const char *text) {
 	size_t length = strlen(text);
 	char *string = malloc(length + 1);
@@ -11,3 +15,15 @@ char* strdup(const char *text) {
 	string[length] = '\0';
 	return string;
 }
+
+bool write_fully(int fd, const void *data, size_t size) {
+	const char *bytes = data;
+	while (size > 0) {
+		ssize_t n = write(fd, bytes, size);
+		if (n < 0 and errno == EINTR) continue;
+		if (n <= 0) return false;
+		bytes += n;
+		size -= n;
+	}
+	return true;
+}